@@ -1,15 +1,91 @@
+#define _GNU_SOURCE
+
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <utmp.h>
+#include <pwd.h>
 #include <limits.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <sys/wait.h>
 #include <sys/utsname.h>
 #include <sys/sysinfo.h>
 #include <wayland-client.h>
 #include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_SDT 1
+#endif
+#endif
+
+// USDT probes for bpftrace and perf: a single nop when sys/sdt.h is available, nothing otherwise
+#ifdef HAVE_SDT
+#define PROBE1(name, a) DTRACE_PROBE1(xfetch, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(xfetch, name, a, b)
+#else
+#define PROBE1(name, a) ((void)(a))
+#define PROBE2(name, a, b) ((void)(a), (void)(b))
+#endif
 
 #define MAX_LINE_LENGTH 256
+#define HASH_SEED 1469598103934665603ULL
+#define DNS_TIMEOUT_MS_DEFAULT 150
+#define MAX_VERSION_LENGTH 64
+#define MAX_FIELDS 32
+#define MAX_FAULT_RULES 16
+#define LOG_CHUNK_SIZE 65536
+#define LOG_SCAN_LIMIT (8 << 20)
+#define WTMP_CHUNK_RECORDS 256
+#define WTMP_MAX_RECORDS 65536
+#define DBUS_TIMEOUT_MS 250
+#define DBUS_SYSTEM_SOCKET "/run/dbus/system_bus_socket"
+#define MAX_GPUS 8
+#define MAX_CPUS 1024
+#define CPU_SYSFS_DIR "/sys/devices/system/cpu"
+#define LOGO_GAP 3
+#define MAX_CELL_BYTES 8
+#define SNAPSHOT_DIR "/run/xfetch"
+#define SNAPSHOT_PATH SNAPSHOT_DIR "/system.snap"
+#define SNAPSHOT_MAGIC "XFSNAP\0\0"
+#define SNAPSHOT_VERSION 1
+#define MAX_REQUEST_LENGTH 4096
+#define MAX_BLOBS 16
+#define DAEMON_TIMEOUT_MS 500
+#define DAEMON_AGE_SLACK_MS 500
+#define LAST_LOGIN_CACHE_SLOTS 8
+#define WATCH_INTERVAL_MS_DEFAULT 2000
+#define MAX_FRAME_LENGTH (1 << 20)
+#define FANOUT_JOBS_DEFAULT 64
+#define FANOUT_TIMEOUT_MS_DEFAULT 10000
+#define FANOUT_TRANSPORT_DEFAULT "exec ssh -T -o BatchMode=yes -o ConnectTimeout=5 -- \"$1\" xfetch --agent"
 
 // A helper function to handle errors and exit
 void handle_error(const char* message) {
@@ -41,6 +117,414 @@ const char* get_env_or_default(const char* var, const char* fallback) {
     return value ? value : fallback;
 }
 
+// A pure function to read the monotonic clock in milliseconds
+long long monotonic_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// An injected fault: every I/O whose name matches the pattern is delayed, failed or cut short
+struct fault_rule {
+    char pattern[PATH_MAX];
+    long delay_ms;
+    int error;
+    size_t truncate;
+};
+
+static struct {
+    pthread_once_t once;
+    struct fault_rule rules[MAX_FAULT_RULES];
+    size_t count;
+} faults = { .once = PTHREAD_ONCE_INIT };
+
+// Function to parse XFETCH_FAULTS, e.g. "/proc/cpuinfo=delay:200,truncate:64;x11:*=eio;dns:*=delay:1000"
+void load_fault_rules() {
+    const char* spec = getenv("XFETCH_FAULTS");
+    if (!spec || !*spec) return;
+
+    char* copy = strdup(spec);
+    if (!copy) handle_error("Memory allocation failed");
+
+    char* rule_save = NULL;
+    for (char* rule = strtok_r(copy, ";", &rule_save); rule && faults.count < MAX_FAULT_RULES;
+         rule = strtok_r(NULL, ";", &rule_save)) {
+        char* actions = strrchr(rule, '=');
+        if (!actions) continue;
+        *actions++ = '\0';
+
+        struct fault_rule* fault = &faults.rules[faults.count];
+        memset(fault, 0, sizeof(*fault));
+        snprintf(fault->pattern, sizeof(fault->pattern), "%s", rule);
+        fault->truncate = SIZE_MAX;
+
+        // A rule that does nothing would still shadow every later rule for the same names, so it is dropped
+        int valid = 0;
+        char* action_save = NULL;
+        for (char* action = strtok_r(actions, ",", &action_save); action; action = strtok_r(NULL, ",", &action_save)) {
+            if (strncmp(action, "delay:", 6) == 0) {
+                fault->delay_ms = strtol(action + 6, NULL, 10);
+            } else if (strncmp(action, "truncate:", 9) == 0) {
+                fault->truncate = strtoul(action + 9, NULL, 10);
+            } else if (strcmp(action, "eio") == 0) {
+                fault->error = EIO;
+            } else if (strcmp(action, "eagain") == 0) {
+                fault->error = EAGAIN;
+            } else {
+                fprintf(stderr, "xfetch: unknown fault action '%s'\n", action);
+                valid = -1;
+                break;
+            }
+            if (valid == 0) valid = 1;
+        }
+
+        if (valid == 1) {
+            faults.count++;
+        } else {
+            fprintf(stderr, "xfetch: ignoring fault rule for '%s'\n", fault->pattern);
+        }
+    }
+    free(copy);
+}
+
+// Function to apply the first fault matching an I/O name: sleeps, then fails with errno set or reports a byte limit
+int inject_fault(const char* name, size_t* limit) {
+    if (limit) *limit = SIZE_MAX;
+    pthread_once(&faults.once, load_fault_rules);
+
+    for (size_t i = 0; i < faults.count; i++) {
+        const struct fault_rule* fault = &faults.rules[i];
+        if (fnmatch(fault->pattern, name, 0) != 0) continue;
+
+        if (fault->delay_ms > 0) {
+            struct timespec delay = { fault->delay_ms / 1000, (fault->delay_ms % 1000) * 1000000L };
+            while (nanosleep(&delay, &delay) == -1 && errno == EINTR) {}
+        }
+        if (fault->error) {
+            errno = fault->error;
+            return -1;
+        }
+        if (limit) *limit = fault->truncate;
+        return 0;
+    }
+    return 0;
+}
+
+// Function to open a file for the collectors, limit is how many bytes of it may be read
+int io_open(const char* path, int flags, size_t* limit) {
+    if (inject_fault(path, limit) == -1) return -1;
+    return open(path, flags);
+}
+
+// Function to open a file relative to a directory for the collectors, faults match dir_path/path
+int io_openat(int dir_fd, const char* dir_path, const char* path, int flags, size_t* limit) {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s/%s", dir_path, path);
+    if (inject_fault(name, limit) == -1) return -1;
+    return openat(dir_fd, path, flags);
+}
+
+// Function to open a file as a stream for the collectors, a truncated file becomes an in-memory prefix
+FILE* io_fopen(const char* path, const char* mode) {
+    size_t limit;
+    if (inject_fault(path, &limit) == -1) return NULL;
+
+    FILE* file = fopen(path, mode);
+    if (!file || limit == SIZE_MAX) return file;
+
+    // The prefix is read first so the stream is only as large as what the file actually held
+    char* data = NULL;
+    size_t length = 0;
+    char buf[4096];
+    size_t n;
+    while (limit > 0 && (n = fread(buf, 1, limit < sizeof(buf) ? limit : sizeof(buf), file)) > 0) {
+        char* grown = realloc(data, length + n);
+        if (!grown) handle_error("Memory allocation failed");
+        data = grown;
+        memcpy(data + length, buf, n);
+        length += n;
+        limit -= n;
+    }
+    fclose(file);
+
+    FILE* prefix = fmemopen(NULL, length + 1, "w+");
+    if (prefix) {
+        fwrite(data, 1, length, prefix);
+        rewind(prefix);
+    }
+    free(data);
+    return prefix;
+}
+
+// Function to open a directory for the collectors
+DIR* io_opendir(const char* path) {
+    if (inject_fault(path, NULL) == -1) return NULL;
+    return opendir(path);
+}
+
+// Function to stat a file for the collectors
+int io_stat(const char* path, struct stat* st) {
+    if (inject_fault(path, NULL) == -1) return -1;
+    return stat(path, st);
+}
+
+// Function to stat a file relative to a directory for the collectors, faults match dir_path/path
+int io_fstatat(int dir_fd, const char* dir_path, const char* path, struct stat* st, int flags) {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s/%s", dir_path, path);
+    if (inject_fault(name, NULL) == -1) return -1;
+    return fstatat(dir_fd, path, st, flags);
+}
+
+// Function to check whether a file exists or may be accessed for the collectors
+int io_access(const char* path, int mode) {
+    if (inject_fault(path, NULL) == -1) return -1;
+    return access(path, mode);
+}
+
+// Function to read a symbolic link for the collectors
+ssize_t io_readlink(const char* path, char* buf, size_t size) {
+    if (inject_fault(path, NULL) == -1) return -1;
+    return readlink(path, buf, size);
+}
+
+// Function to read a symbolic link relative to a directory for the collectors, faults match dir_path/path
+ssize_t io_readlinkat(int dir_fd, const char* dir_path, const char* path, char* buf, size_t size) {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s/%s", dir_path, path);
+    if (inject_fault(name, NULL) == -1) return -1;
+    return readlinkat(dir_fd, path, buf, size);
+}
+
+// Function to resolve a path to its canonical form for the collectors
+char* io_realpath(const char* path, char* resolved) {
+    if (inject_fault(path, NULL) == -1) return NULL;
+    return realpath(path, resolved);
+}
+
+// Function to connect a socket for the collectors, unix sockets are matched by their path
+int io_connect(int fd, const struct sockaddr* addr, socklen_t length) {
+    if (addr->sa_family == AF_UNIX && inject_fault(((const struct sockaddr_un*)addr)->sun_path, NULL) == -1) return -1;
+    return connect(fd, addr, length);
+}
+
+// Function to connect to the X server for the collectors, matched as "x11:$DISPLAY"
+Display* io_open_display() {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "x11:%s", get_env_or_default("DISPLAY", ""));
+    if (inject_fault(name, NULL) == -1) return NULL;
+    return XOpenDisplay(NULL);
+}
+
+// Function to connect to the Wayland compositor for the collectors, matched as "wayland:$WAYLAND_DISPLAY"
+struct wl_display* io_connect_wayland() {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "wayland:%s", get_env_or_default("WAYLAND_DISPLAY", "wayland-0"));
+    if (inject_fault(name, NULL) == -1) return NULL;
+    return wl_display_connect(NULL);
+}
+
+// Function to read a small file into a NUL-terminated buffer, returns the length or -1
+ssize_t read_file(const char* path, char* buf, size_t size) {
+    size_t limit;
+    int fd = io_open(path, O_RDONLY | O_CLOEXEC, &limit);
+    if (fd == -1) return -1;
+    if (limit < size - 1) size = limit + 1;
+
+    size_t length = 0;
+    while (length + 1 < size) {
+        ssize_t n = read(fd, buf + length, size - length - 1);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        length += n;
+    }
+
+    close(fd);
+    buf[length] = '\0';
+    return length;
+}
+
+// Function to write a whole buffer to a file descriptor, retrying short writes
+int write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) {
+            struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (n <= 0) return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+// A pure function to fold bytes into a 64-bit FNV-1a hash
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Function to fold the contents of a file into a hash, a missing file hashes as empty
+uint64_t hash_file(uint64_t hash, const char* path) {
+    size_t limit;
+    int fd = io_open(path, O_RDONLY | O_CLOEXEC, &limit);
+    if (fd == -1) return hash_bytes(hash, "-", 1);
+
+    char buf[4096];
+    ssize_t n;
+    while (limit > 0 && ((n = read(fd, buf, limit < sizeof(buf) ? limit : sizeof(buf))) > 0 || (n == -1 && errno == EINTR))) {
+        if (n <= 0) continue;
+        hash = hash_bytes(hash, buf, n);
+        limit -= n;
+    }
+
+    close(fd);
+    return hash;
+}
+
+// Function to build the path of a cache entry, creating the cache directory on the way
+int get_cache_path(const char* name, char* path, size_t size) {
+    const char* cache_home = getenv("XDG_CACHE_HOME");
+    int length;
+
+    if (cache_home && *cache_home) {
+        mkdir(cache_home, 0700);
+        length = snprintf(path, size, "%s/xfetch", cache_home);
+    } else {
+        const char* home = getenv("HOME");
+        if (!home || !*home) return -1;
+        length = snprintf(path, size, "%s/.cache", home);
+        if (length < 0 || (size_t)length >= size) return -1;
+        mkdir(path, 0700);
+        length = snprintf(path, size, "%s/.cache/xfetch", home);
+    }
+
+    if (length < 0 || (size_t)length >= size) return -1;
+    if (mkdir(path, 0700) == -1 && errno != EEXIST) return -1;
+
+    int name_length = snprintf(path + length, size - length, "/%s", name);
+    return name_length < 0 || (size_t)(length + name_length) >= size ? -1 : 0;
+}
+
+// Function to load a cached value, NULL unless it was stored under the same key
+char* cache_load(const char* name, uint64_t key) {
+    char path[PATH_MAX];
+    char buf[4096];
+    if (get_cache_path(name, path, sizeof(path)) == -1) return NULL;
+    if (read_file(path, buf, sizeof(buf)) < 17) {
+        PROBE1(cache__miss, name);
+        return NULL;
+    }
+
+    char* value = NULL;
+    if (strtoull(buf, &value, 16) != key || *value != '\n') {
+        PROBE1(cache__miss, name);
+        return NULL;
+    }
+
+    PROBE1(cache__hit, name);
+    value++;
+    value[strcspn(value, "\n")] = '\0';
+    char* result = strdup(value);
+    if (!result) handle_error("Memory allocation failed");
+    return result;
+}
+
+// Function to store a value in the cache, replacing the entry atomically
+void cache_store(const char* name, uint64_t key, const char* value) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX + 16];
+    if (get_cache_path(name, path, sizeof(path)) == -1) return;
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long)getpid());
+
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) return;
+    fprintf(file, "%016llx\n%s\n", (unsigned long long)key, value);
+
+    if (fclose(file) == 0) {
+        rename(tmp_path, path);
+    } else {
+        unlink(tmp_path);
+    }
+}
+
+// A growable byte buffer used to assemble output records
+struct buffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+};
+
+// Function to append bytes to a buffer, growing it as needed
+void buffer_append(struct buffer* buffer, const char* data, size_t length) {
+    if (buffer->length + length + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (buffer->length + length + 1 > capacity) capacity *= 2;
+        buffer->data = realloc(buffer->data, capacity);
+        if (!buffer->data) handle_error("Memory allocation failed");
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+}
+
+// Function to append formatted text to a buffer
+void buffer_printf(struct buffer* buffer, const char* format, ...) {
+    char stack[MAX_LINE_LENGTH];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(stack, sizeof(stack), format, args);
+    va_end(args);
+    if (length < 0) return;
+
+    if ((size_t)length < sizeof(stack)) {
+        buffer_append(buffer, stack, length);
+        return;
+    }
+
+    char* heap = malloc(length + 1);
+    if (!heap) handle_error("Memory allocation failed");
+    va_start(args, format);
+    vsnprintf(heap, length + 1, format, args);
+    va_end(args);
+    buffer_append(buffer, heap, length);
+    free(heap);
+}
+
+// Function to append a string as a quoted JSON string, or null when it is NULL
+void buffer_append_json(struct buffer* buffer, const char* str) {
+    if (!str) {
+        buffer_append(buffer, "null", 4);
+        return;
+    }
+
+    buffer_append(buffer, "\"", 1);
+    const char* run = str;
+    for (const char* p = str; *p; p++) {
+        unsigned char c = *p;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        buffer_append(buffer, run, p - run);
+        if (c == '"' || c == '\\') {
+            char escaped[2] = { '\\', c };
+            buffer_append(buffer, escaped, 2);
+        } else {
+            buffer_printf(buffer, "\\u%04x", c);
+        }
+        run = p + 1;
+    }
+    buffer_append(buffer, run, strlen(run));
+    buffer_append(buffer, "\"", 1);
+}
+
 // A pure function to extract a quoted string from a line
 char* extract_quoted_string(const char* line) {
     const char* start = strchr(line, '"');
@@ -58,7 +542,7 @@ char* extract_quoted_string(const char* line) {
 
 // A pure function to get the OS name from /etc/os-release
 char* get_os_name() {
-    FILE* file = fopen("/etc/os-release", "r");
+    FILE* file = io_fopen("/etc/os-release", "r");
     if (!file) return NULL;
 
     char line[MAX_LINE_LENGTH];
@@ -75,6 +559,157 @@ char* get_os_name() {
     return result;
 }
 
+// Function to find the canonical name of a host in /etc/hosts, NULL if not listed with a domain
+char* lookup_hosts_fqdn(const char* hostname) {
+    FILE* file = io_fopen("/etc/hosts", "r");
+    if (!file) return NULL;
+
+    size_t hostname_length = strlen(hostname);
+    char line[MAX_LINE_LENGTH];
+    char* result = NULL;
+
+    while (!result && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "#\n")] = '\0';
+
+        char* save = NULL;
+        if (!strtok_r(line, " \t", &save)) continue;
+
+        char* canonical = strtok_r(NULL, " \t", &save);
+        for (char* name = canonical; name; name = strtok_r(NULL, " \t", &save)) {
+            int matches = strcmp(name, hostname) == 0 ||
+                          (strncmp(name, hostname, hostname_length) == 0 && name[hostname_length] == '.');
+            if (!matches) continue;
+
+            // Prefer the canonical name, fall back to a qualified alias
+            if (strchr(canonical, '.')) {
+                result = strdup(canonical);
+            } else if (strchr(name, '.')) {
+                result = strdup(name);
+            }
+            break;
+        }
+    }
+
+    fclose(file);
+    return result;
+}
+
+// State shared with the resolver thread, static so an abandoned lookup can finish safely
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+    int busy;
+    int done;
+    char hostname[NI_MAXHOST];
+    char canonical[NI_MAXHOST];
+} fqdn_lookup = { .lock = PTHREAD_MUTEX_INITIALIZER, .done_cond = PTHREAD_COND_INITIALIZER };
+
+// Thread body running the potentially blocking getaddrinfo() call
+void* resolve_fqdn_thread(void* arg) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_flags = AI_CANONNAME };
+    struct addrinfo* info = NULL;
+    char canonical[NI_MAXHOST] = "";
+
+    char fault_name[NI_MAXHOST + 4];
+    snprintf(fault_name, sizeof(fault_name), "dns:%s", fqdn_lookup.hostname);
+    if (inject_fault(fault_name, NULL) == 0 && getaddrinfo(fqdn_lookup.hostname, NULL, &hints, &info) == 0) {
+        if (info && info->ai_canonname) {
+            snprintf(canonical, sizeof(canonical), "%s", info->ai_canonname);
+        }
+        freeaddrinfo(info);
+    }
+
+    pthread_mutex_lock(&fqdn_lookup.lock);
+    memcpy(fqdn_lookup.canonical, canonical, sizeof(canonical));
+    fqdn_lookup.done = 1;
+    fqdn_lookup.busy = 0;
+    pthread_cond_signal(&fqdn_lookup.done_cond);
+    pthread_mutex_unlock(&fqdn_lookup.lock);
+    return NULL;
+}
+
+// Function to resolve the canonical name through DNS, giving up after timeout_ms
+char* resolve_fqdn(const char* hostname, long timeout_ms) {
+    pthread_mutex_lock(&fqdn_lookup.lock);
+    if (fqdn_lookup.busy) {
+        // A previous lookup is still stuck, never queue another one behind it
+        pthread_mutex_unlock(&fqdn_lookup.lock);
+        return NULL;
+    }
+
+    snprintf(fqdn_lookup.hostname, sizeof(fqdn_lookup.hostname), "%s", hostname);
+    fqdn_lookup.busy = 1;
+    fqdn_lookup.done = 0;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, resolve_fqdn_thread, NULL) != 0) {
+        fqdn_lookup.busy = 0;
+        pthread_attr_destroy(&attr);
+        pthread_mutex_unlock(&fqdn_lookup.lock);
+        return NULL;
+    }
+    pthread_attr_destroy(&attr);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (!fqdn_lookup.done) {
+        if (pthread_cond_timedwait(&fqdn_lookup.done_cond, &fqdn_lookup.lock, &deadline) == ETIMEDOUT) break;
+    }
+
+    // A failed lookup leaves canonical empty and counts as no answer, like a timeout
+    char* result = NULL;
+    if (fqdn_lookup.done && fqdn_lookup.canonical[0]) {
+        result = strdup(fqdn_lookup.canonical);
+        if (!result) handle_error("Memory allocation failed");
+    }
+
+    pthread_mutex_unlock(&fqdn_lookup.lock);
+    return result;
+}
+
+// Function to get the fully qualified hostname without ever blocking on DNS
+char* get_fqdn(const char* hostname) {
+    if (strchr(hostname, '.')) return strdup(hostname);
+
+    uint64_t key = hash_bytes(HASH_SEED, hostname, strlen(hostname) + 1);
+    key = hash_file(key, "/etc/resolv.conf");
+    key = hash_file(key, "/etc/hosts");
+
+    char* fqdn = cache_load("fqdn", key);
+    if (fqdn) return fqdn;
+
+    // Local fast path: /etc/hostname may already hold the full name, then /etc/hosts
+    char buf[MAX_LINE_LENGTH];
+    if (read_file("/etc/hostname", buf, sizeof(buf)) > 0) {
+        buf[strcspn(buf, " \t\n")] = '\0';
+        size_t length = strlen(hostname);
+        if (strncmp(buf, hostname, length) == 0 && buf[length] == '.') fqdn = strdup(buf);
+    }
+    if (!fqdn) fqdn = lookup_hosts_fqdn(hostname);
+
+    if (!fqdn) {
+        const char* timeout = getenv("XFETCH_DNS_TIMEOUT_MS");
+        long timeout_ms = timeout ? atol(timeout) : DNS_TIMEOUT_MS_DEFAULT;
+        if (timeout_ms > 0) fqdn = resolve_fqdn(hostname, timeout_ms);
+
+        // A timed out or failed lookup is not cached so the next run gets another chance
+        if (!fqdn) return strdup(hostname);
+    }
+
+    cache_store("fqdn", key, fqdn);
+    return fqdn;
+}
+
 // A pure function to concatenate OS and kernel version
 char* get_kernel_info(const struct utsname* sys_info) {
     size_t length = strlen(sys_info->sysname) + strlen(sys_info->release) + 2;
@@ -84,6 +719,71 @@ char* get_kernel_info(const struct utsname* sys_info) {
     return kernel_info;
 }
 
+// A pure function to check whether two kernel releases are of one flavor, e.g. both "-generic" or both "-arch"
+// Version and package release numbers are skipped wherever they appear: 6.10.3-arch1-1 and 6.10.4-arch1-2 match
+int kernel_flavors_match(const char* a, const char* b) {
+    for (;;) {
+        while (*a && (isdigit((unsigned char)*a) || strchr(".-_+~", *a))) a++;
+        while (*b && (isdigit((unsigned char)*b) || strchr(".-_+~", *b))) b++;
+        if (*a != *b) return 0;
+        if (!*a) return 1;
+        a++;
+        b++;
+    }
+}
+
+// Function to find the newest kernel of the running flavor in a directory, entries are the name after prefix
+// Returns -1 if the directory cannot be read, otherwise whether the running release was among the entries
+int scan_kernels(const char* path, const char* prefix, const char* release, char* newest, size_t size) {
+    int fd = io_open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC, NULL);
+    if (fd == -1) return -1;
+
+    // /lib/modules and /boot hold a handful of entries, one getdents64 call normally returns all of them
+    char buf[32768];
+    size_t prefix_length = strlen(prefix);
+    int found = 0;
+    ssize_t n;
+    while ((n = getdents64(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t offset = 0; offset < n;) {
+            struct dirent64* entry = (struct dirent64*)(buf + offset);
+            offset += entry->d_reclen;
+
+            if (strncmp(entry->d_name, prefix, prefix_length) != 0) continue;
+            const char* version = entry->d_name + prefix_length;
+            if (!isdigit((unsigned char)*version)) continue;
+
+            if (strcmp(version, release) == 0) found = 1;
+            // A generic and a cloud kernel of the same version are not upgrades of one another
+            if (!kernel_flavors_match(version, release)) continue;
+            if (strverscmp(version, newest) > 0) snprintf(newest, size, "%s", version);
+        }
+    }
+
+    close(fd);
+    return found;
+}
+
+// Function to tell whether the running kernel has been replaced or the distribution asks for a reboot
+char* get_reboot_status(const struct utsname* sys_info) {
+    char newest[NAME_MAX + 1];
+    snprintf(newest, sizeof(newest), "%s", sys_info->release);
+
+    int modules = scan_kernels("/lib/modules", "", sys_info->release, newest, sizeof(newest));
+    scan_kernels("/boot", "vmlinuz-", sys_info->release, newest, sizeof(newest));
+
+    struct buffer out = { 0 };
+    if (strcmp(newest, sys_info->release) != 0) {
+        buffer_printf(&out, "Reboot pending (kernel %s installed)", newest);
+    } else if (modules == 0) {
+        buffer_printf(&out, "Reboot pending (modules of the running kernel removed)");
+    } else if (io_access("/var/run/reboot-required", F_OK) == 0) {
+        buffer_printf(&out, "Reboot pending");
+    } else if (modules == 1) {
+        buffer_printf(&out, "Not required");
+    }
+    return out.data;
+}
+
 // A pure function to capitalize the first character of a string
 char* capitalize_first(const char* str) {
     if (!str) return NULL;
@@ -101,8 +801,17 @@ char* get_session_type() {
     }
 
     // Fallbacks
-    if (XOpenDisplay(NULL)) return strdup("X11");
-    if (wl_display_connect(NULL)) return strdup("Wayland");
+    Display* x_display = io_open_display();
+    if (x_display) {
+        XCloseDisplay(x_display);
+        return strdup("X11");
+    }
+
+    struct wl_display* wl_display = io_connect_wayland();
+    if (wl_display) {
+        wl_display_disconnect(wl_display);
+        return strdup("Wayland");
+    }
 
     return strdup("Unknown");
 }
@@ -118,53 +827,6 @@ char* get_desktop_environment() {
     return strdup("Unknown");
 }
 
-// A pure function to detect the window manager or compositor
-char* get_window_manager() {
-    const char* session_type = getenv("XDG_SESSION_TYPE");
-
-    if (session_type && strcmp(session_type, "wayland") == 0) {
-        const char* desktop = getenv("XDG_CURRENT_DESKTOP");
-        const char* session = getenv("DESKTOP_SESSION");
-
-        if (desktop && strstr(desktop, "GNOME")) return strdup("Mutter (Wayland)");
-        if (desktop && strstr(desktop, "KDE") && session &&
-            (strstr(session, "plasma") || strstr(session, "kde"))) {
-            return strdup("KWin (Wayland)");
-        }
-
-        return strdup("Wayland Compositor");
-    }
-
-    if (session_type && strcmp(session_type, "x11") == 0) {
-        Display* display = XOpenDisplay(NULL);
-        if (!display) return strdup("Unknown WM");
-
-        char* wm_name = NULL;
-        Atom wm_atom = XInternAtom(display, "_NET_WM_NAME", True);
-        Atom utf8_string = XInternAtom(display, "UTF8_STRING", True);
-        Window root = DefaultRootWindow(display);
-
-        if (wm_atom != None && utf8_string != None) {
-            Atom actual_type;
-            int actual_format;
-            unsigned long nitems, bytes_after;
-            unsigned char* prop = NULL;
-
-            if (XGetWindowProperty(display, root, wm_atom, 0, 1024, False, utf8_string,
-                                   &actual_type, &actual_format, &nitems, &bytes_after, &prop) == Success &&
-                prop) {
-                wm_name = strdup((char*)prop);
-                XFree(prop);
-            }
-        }
-
-        XCloseDisplay(display);
-        return wm_name ? wm_name : strdup("Unknown WM");
-    }
-
-    return strdup("Unknown");
-}
-
 // A pure function to get system uptime
 char* get_uptime(const struct sysinfo* sys_runtime_info) {
     long uptime_seconds = sys_runtime_info->uptime;
@@ -185,35 +847,4338 @@ char* get_uptime(const struct sysinfo* sys_runtime_info) {
     return uptime_str;
 }
 
-// Main function
-int main() {
-    struct utsname sys_info = get_system_info();
-    struct sysinfo sys_runtime_info = get_system_runtime_info();
+// A pure function to format a byte count with a binary unit
+void format_size(unsigned long long bytes, char* buf, size_t size) {
+    const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB", "PiB" };
+    double value = bytes;
+    size_t unit = 0;
+    while (value >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        value /= 1024;
+        unit++;
+    }
+    snprintf(buf, size, unit ? "%.2f %s" : "%.0f %s", value, units[unit]);
+}
 
-    char* os_name = get_os_name();
-    char* kernel_info = get_kernel_info(&sys_info);
-    char* session_type = get_session_type();
-    char* desktop_env = get_desktop_environment();
-    char* window_manager = get_window_manager();
-    char* uptime = get_uptime(&sys_runtime_info);
-    char* hostname = strdup(sys_info.nodename);
-
-    printf("Hostname: %s\n", hostname);
-    printf("Operating System: %s\n", os_name ? os_name : "Unknown");
-    printf("Kernel: %s\n", kernel_info);
-    printf("Session Type: %s\n", session_type);
-    printf("Desktop Environment: %s\n", desktop_env);
-    printf("Window Manager/Compositor: %s\n", window_manager);
-    printf("Uptime: %s\n", uptime);
+// Function to get swap usage enriched with devices, priorities and zram compression ratios
+char* get_swap_info(const struct sysinfo* sys_runtime_info) {
+    unsigned long long total = (unsigned long long)sys_runtime_info->totalswap * sys_runtime_info->mem_unit;
+    unsigned long long used = total - (unsigned long long)sys_runtime_info->freeswap * sys_runtime_info->mem_unit;
+    struct buffer devices = { 0 };
 
-    // Free allocated memory
-    free(os_name);
-    free(kernel_info);
-    free(session_type);
-    free(desktop_env);
-    free(window_manager);
-    free(uptime);
-    free(hostname);
+    // Filename Type Size Used Priority, one swap area per line after the header
+    char swaps[4096];
+    if (read_file("/proc/swaps", swaps, sizeof(swaps)) > 0) {
+        char* save = NULL;
+        strtok_r(swaps, "\n", &save);
+        for (char* line = strtok_r(NULL, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+            char name[PATH_MAX];
+            int priority;
+            if (sscanf(line, "%4095s %*s %*s %*s %d", name, &priority) != 2) continue;
+
+            const char* base = strncmp(name, "/dev/", 5) == 0 ? name + 5 : name;
+            buffer_printf(&devices, "%s%s prio %d", devices.length ? "; " : "", base, priority);
+            if (strncmp(base, "zram", 4) != 0) continue;
+
+            // orig_data_size compr_data_size mem_used_total ...
+            char stat_path[PATH_MAX + 32];
+            char stat[MAX_LINE_LENGTH];
+            unsigned long long orig, compressed;
+            snprintf(stat_path, sizeof(stat_path), "/sys/block/%s/mm_stat", base);
+            if (read_file(stat_path, stat, sizeof(stat)) > 0 &&
+                sscanf(stat, "%llu %llu", &orig, &compressed) == 2 && compressed > 0) {
+                buffer_printf(&devices, ", %.1fx", (double)orig / compressed);
+            }
+        }
+    }
+
+    if (total == 0) {
+        free(devices.data);
+        return NULL;
+    }
+
+    char used_str[32], total_str[32];
+    format_size(used, used_str, sizeof(used_str));
+    format_size(total, total_str, sizeof(total_str));
+
+    struct buffer out = { 0 };
+    buffer_printf(&out, "%s / %s", used_str, total_str);
+    if (devices.length) buffer_printf(&out, " (%s)", devices.data);
+    free(devices.data);
+    return out.data;
+}
 
+// Function to map a whole file read-only, NULL if it is missing or empty
+void* map_file(const char* path, size_t* size) {
+    size_t limit;
+    int fd = io_open(path, O_RDONLY | O_CLOEXEC, &limit);
+    if (fd == -1) return NULL;
+
+    // A truncated file maps only its prefix, the caller unmaps the same length it is told
+    struct stat st;
+    void* data = NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t length = (size_t)st.st_size < limit ? (size_t)st.st_size : limit;
+        data = length ? mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (data == MAP_FAILED) {
+            data = NULL;
+        } else {
+            *size = length;
+        }
+    }
+
+    close(fd);
+    return data;
+}
+
+// Function to read a one-line sysfs attribute, NULL when it is missing or empty
+char* read_sysfs_string(const char* path) {
+    char buf[MAX_LINE_LENGTH];
+    if (read_file(path, buf, sizeof(buf)) <= 0) return NULL;
+    buf[strcspn(buf, "\n")] = '\0';
+    return buf[0] ? strdup(buf) : NULL;
+}
+
+// A pure function to recognise firmware placeholder strings
+int is_placeholder(const char* str) {
+    static const char* const placeholders[] = {
+        "To be filled by O.E.M.", "To Be Filled By O.E.M.", "Default string", "System Product Name",
+        "System manufacturer", "Not Applicable", "None", "O.E.M.",
+    };
+    for (size_t i = 0; i < sizeof(placeholders) / sizeof(placeholders[0]); i++) {
+        if (strcmp(str, placeholders[i]) == 0) return 1;
+    }
     return 0;
 }
+
+// Function to get the machine model from DMI, or from the device tree on boards without it
+char* get_host_model() {
+    char* vendor = read_sysfs_string("/sys/class/dmi/id/sys_vendor");
+    char* product = read_sysfs_string("/sys/class/dmi/id/product_name");
+    if (vendor && is_placeholder(vendor)) {
+        free(vendor);
+        vendor = NULL;
+    }
+    if (product && is_placeholder(product)) {
+        free(product);
+        product = NULL;
+    }
+
+    if (!product) {
+        free(vendor);
+        char model[MAX_LINE_LENGTH];
+        if (read_file("/sys/firmware/devicetree/base/model", model, sizeof(model)) > 0 && model[0]) {
+            return strdup(model);
+        }
+        return NULL;
+    }
+
+    if (!vendor || strncmp(product, vendor, strlen(vendor)) == 0) {
+        free(vendor);
+        return product;
+    }
+
+    size_t size = strlen(vendor) + strlen(product) + 2;
+    char* host = malloc(size);
+    if (!host) handle_error("Memory allocation failed");
+    snprintf(host, size, "%s %s", vendor, product);
+    free(vendor);
+    free(product);
+    return host;
+}
+
+// Known ARM cores by MIDR implementer and part number
+static const struct arm_part {
+    uint8_t implementer;
+    uint16_t part;
+    const char* name;
+} arm_parts[] = {
+    { 0x41, 0xc07, "Cortex-A7" },      { 0x41, 0xc09, "Cortex-A9" },      { 0x41, 0xc0d, "Cortex-A12" },
+    { 0x41, 0xc0e, "Cortex-A17" },     { 0x41, 0xc0f, "Cortex-A15" },     { 0x41, 0xd01, "Cortex-A32" },
+    { 0x41, 0xd02, "Cortex-A34" },     { 0x41, 0xd03, "Cortex-A53" },     { 0x41, 0xd04, "Cortex-A35" },
+    { 0x41, 0xd05, "Cortex-A55" },     { 0x41, 0xd07, "Cortex-A57" },     { 0x41, 0xd08, "Cortex-A72" },
+    { 0x41, 0xd09, "Cortex-A73" },     { 0x41, 0xd0a, "Cortex-A75" },     { 0x41, 0xd0b, "Cortex-A76" },
+    { 0x41, 0xd0c, "Neoverse-N1" },    { 0x41, 0xd0d, "Cortex-A77" },     { 0x41, 0xd40, "Neoverse-V1" },
+    { 0x41, 0xd41, "Cortex-A78" },     { 0x41, 0xd44, "Cortex-X1" },      { 0x41, 0xd46, "Cortex-A510" },
+    { 0x41, 0xd47, "Cortex-A710" },    { 0x41, 0xd48, "Cortex-X2" },      { 0x41, 0xd49, "Neoverse-N2" },
+    { 0x41, 0xd4a, "Neoverse-E1" },    { 0x41, 0xd4b, "Cortex-A78C" },    { 0x41, 0xd4d, "Cortex-A715" },
+    { 0x41, 0xd4e, "Cortex-X3" },      { 0x41, 0xd4f, "Neoverse-V2" },    { 0x41, 0xd80, "Cortex-A520" },
+    { 0x41, 0xd81, "Cortex-A720" },    { 0x41, 0xd82, "Cortex-X4" },      { 0x41, 0xd84, "Neoverse-V3" },
+    { 0x41, 0xd85, "Cortex-X925" },    { 0x41, 0xd87, "Cortex-A725" },    { 0x41, 0xd8e, "Neoverse-N3" },
+    { 0x42, 0x516, "ThunderX2" },      { 0x43, 0x0a1, "ThunderX" },       { 0x43, 0x0af, "ThunderX2" },
+    { 0x46, 0x001, "A64FX" },          { 0x48, 0xd01, "TaiShan v110" },   { 0x4e, 0x004, "Carmel" },
+    { 0x51, 0x001, "Oryon" },          { 0x51, 0x800, "Kryo 2XX Gold" },  { 0x51, 0x801, "Kryo 2XX Silver" },
+    { 0x51, 0x802, "Kryo 3XX Gold" },  { 0x51, 0x803, "Kryo 3XX Silver" }, { 0x51, 0x804, "Kryo 4XX Gold" },
+    { 0x51, 0x805, "Kryo 4XX Silver" }, { 0x51, 0xc00, "Falkor" },         { 0x61, 0x022, "Icestorm" },
+    { 0x61, 0x023, "Firestorm" },      { 0x61, 0x032, "Blizzard" },       { 0x61, 0x033, "Avalanche" },
+    { 0x70, 0x662, "FTC662" },         { 0x70, 0x663, "FTC663" },         { 0xc0, 0xac3, "Ampere-1" },
+    { 0xc0, 0xac4, "Ampere-1a" },
+};
+
+// A pure function to name an ARM core from its MIDR, falling back to the implementer and raw part number
+void name_arm_core(uint64_t midr, char* buf, size_t size) {
+    static const struct {
+        uint8_t implementer;
+        const char* name;
+    } implementers[] = {
+        { 0x41, "ARM" },    { 0x42, "Broadcom" }, { 0x43, "Cavium" }, { 0x46, "Fujitsu" }, { 0x48, "HiSilicon" },
+        { 0x4e, "NVIDIA" }, { 0x51, "Qualcomm" }, { 0x61, "Apple" },  { 0x70, "Phytium" }, { 0xc0, "Ampere" },
+    };
+    uint8_t implementer = midr >> 24 & 0xff;
+    uint16_t part = midr >> 4 & 0xfff;
+
+    for (size_t i = 0; i < sizeof(arm_parts) / sizeof(arm_parts[0]); i++) {
+        if (arm_parts[i].implementer == implementer && arm_parts[i].part == part) {
+            snprintf(buf, size, "%s", arm_parts[i].name);
+            return;
+        }
+    }
+    for (size_t i = 0; i < sizeof(implementers) / sizeof(implementers[0]); i++) {
+        if (implementers[i].implementer == implementer) {
+            snprintf(buf, size, "%s part 0x%03x", implementers[i].name, part);
+            return;
+        }
+    }
+    snprintf(buf, size, "ARM implementer 0x%02x part 0x%03x", implementer, part);
+}
+
+// Function to mark the cpus of a sysfs list such as "0-3,8-11" in a bitmap, returns how many were listed
+int parse_cpu_list(const char* list, uint64_t* cpus) {
+    int count = 0;
+    while (*list) {
+        char* end;
+        long first = strtol(list, &end, 10);
+        if (end == list) break;
+        long last = *end == '-' ? strtol(end + 1, &end, 10) : first;
+        for (long cpu = first; cpu <= last && cpu < MAX_CPUS; cpu++) {
+            if (cpu < 0) continue;
+            cpus[cpu / 64] |= 1ULL << (cpu % 64);
+            count++;
+        }
+        list = end + (*end == ',');
+        if (*end && *end != ',') break;
+    }
+    return count;
+}
+
+// Function to describe ARM cores from their MIDR registers, reading one register per cluster
+char* get_arm_cpu_info(const char* cpu_dir) {
+    char path[PATH_MAX];
+    char buf[4096];
+    uint64_t online[MAX_CPUS / 64] = { 0 };
+    snprintf(path, sizeof(path), "%s/online", cpu_dir);
+    if (read_file(path, buf, sizeof(buf)) <= 0 || !parse_cpu_list(buf, online)) return NULL;
+
+    // Core types in order of their first cpu, clusters of the same type add up
+    struct {
+        uint64_t midr;
+        int count;
+    } types[16];
+    size_t type_count = 0;
+    uint64_t covered[MAX_CPUS / 64] = { 0 };
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!(online[cpu / 64] & 1ULL << (cpu % 64)) || covered[cpu / 64] & 1ULL << (cpu % 64)) continue;
+
+        snprintf(path, sizeof(path), "%s/cpu%d/regs/identification/midr_el1", cpu_dir, cpu);
+        if (read_file(path, buf, sizeof(buf)) <= 0) return NULL;
+        uint64_t midr = strtoull(buf, NULL, 16);
+
+        // Every cpu sharing a frequency domain or cluster shares the core type, so one register covers them all
+        // A package mixes big and little cores, without either list every cpu's own register is read
+        static const char* const siblings[] = { "cpufreq/related_cpus", "topology/cluster_cpus_list" };
+        uint64_t cluster[MAX_CPUS / 64] = { 0 };
+        int listed = 0;
+        for (size_t i = 0; !listed && i < sizeof(siblings) / sizeof(siblings[0]); i++) {
+            snprintf(path, sizeof(path), "%s/cpu%d/%s", cpu_dir, cpu, siblings[i]);
+            if (read_file(path, buf, sizeof(buf)) > 0) listed = parse_cpu_list(buf, cluster);
+        }
+        cluster[cpu / 64] |= 1ULL << (cpu % 64);
+
+        int count = 0;
+        for (size_t i = 0; i < MAX_CPUS / 64; i++) {
+            uint64_t fresh = cluster[i] & online[i] & ~covered[i];
+            covered[i] |= fresh;
+            count += __builtin_popcountll(fresh);
+        }
+
+        // Variant and revision do not change what the core is called
+        midr &= 0xff0ffff0;
+        size_t type = 0;
+        while (type < type_count && types[type].midr != midr) type++;
+        if (type == type_count) {
+            if (type_count == sizeof(types) / sizeof(types[0])) continue;
+            types[type_count].midr = midr;
+            types[type_count++].count = 0;
+        }
+        types[type].count += count;
+    }
+
+    struct buffer out = { 0 };
+    for (size_t i = 0; i < type_count; i++) {
+        char name[64];
+        name_arm_core(types[i].midr, name, sizeof(name));
+        if (type_count == 1) {
+            buffer_printf(&out, "%s (%d)", name, types[i].count);
+        } else {
+            buffer_printf(&out, "%s%dx %s", i ? " + " : "", types[i].count, name);
+        }
+    }
+    return out.data;
+}
+
+// Function to get the CPU model with its core and thread counts from MIDR registers or /proc/cpuinfo
+char* get_cpu_info() {
+    // ARM kernels leave the model name out of cpuinfo, the MIDR registers identify the cores instead
+    char* arm = get_arm_cpu_info(CPU_SYSFS_DIR);
+    if (arm) return arm;
+
+    FILE* file = io_fopen("/proc/cpuinfo", "r");
+    if (!file) return NULL;
+
+    char line[MAX_LINE_LENGTH];
+    char model[MAX_LINE_LENGTH] = "";
+    int cores_per_package = 0;
+    unsigned long long packages = 0;
+    int threads = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        char* value = strchr(line, ':');
+        if (!value) continue;
+        value += 1 + strspn(value + 1, " \t");
+        value[strcspn(value, "\n")] = '\0';
+
+        if (strncmp(line, "processor", 9) == 0) {
+            threads++;
+        } else if (!model[0] && strncmp(line, "model name", 10) == 0) {
+            snprintf(model, sizeof(model), "%s", value);
+        } else if (strncmp(line, "cpu cores", 9) == 0) {
+            cores_per_package = atoi(value);
+        } else if (strncmp(line, "physical id", 11) == 0) {
+            int id = atoi(value);
+            if (id >= 0 && id < 64) packages |= 1ULL << id;
+        }
+    }
+    fclose(file);
+
+    if (!model[0]) return NULL;
+
+    // Collapse the runs of spaces some vendors pad the model name with
+    char* out = model;
+    for (char* p = model; *p; p++) {
+        if (*p == ' ' && (out == model || out[-1] == ' ')) continue;
+        *out++ = *p;
+    }
+    while (out > model && out[-1] == ' ') out--;
+    *out = '\0';
+
+    int cores = cores_per_package * (packages ? __builtin_popcountll(packages) : 1);
+    char result[MAX_LINE_LENGTH * 2];
+    if (cores > 0 && cores != threads) {
+        snprintf(result, sizeof(result), "%s (%dC/%dT)", model, cores, threads);
+    } else {
+        snprintf(result, sizeof(result), "%s (%d)", model, threads);
+    }
+    return strdup(result);
+}
+
+// Function to look up a PCI device name in the pci.ids database
+char* lookup_pci_name(unsigned vendor_id, unsigned device_id) {
+    static const char* const databases[] = {
+        "/usr/share/hwdata/pci.ids", "/usr/share/misc/pci.ids", "/usr/share/pci.ids",
+    };
+
+    size_t size = 0;
+    char* data = NULL;
+    for (size_t i = 0; !data && i < sizeof(databases) / sizeof(databases[0]); i++) data = map_file(databases[i], &size);
+    if (!data) return NULL;
+
+    // Vendors start a line with their id, their devices follow indented by one tab
+    char needle[16];
+    snprintf(needle, sizeof(needle), "\n%04x  ", vendor_id);
+    const char* end = data + size;
+    const char* vendor = memmem(data, size, needle, strlen(needle));
+    char* result = NULL;
+
+    if (vendor) {
+        const char* vendor_name = vendor + strlen(needle);
+        const char* vendor_end = memchr(vendor_name, '\n', end - vendor_name);
+        if (!vendor_end) vendor_end = end;
+
+        snprintf(needle, sizeof(needle), "\n\t%04x  ", device_id);
+        size_t needle_length = strlen(needle);
+        const char* line = vendor_end;
+        while (line && end - line > (ptrdiff_t)needle_length && (line[1] == '\t' || line[1] == '#')) {
+            if (memcmp(line, needle, needle_length) == 0) {
+                const char* device_name = line + needle_length;
+                const char* device_end = memchr(device_name, '\n', end - device_name);
+                if (!device_end) device_end = end;
+
+                size_t length = (vendor_end - vendor_name) + (device_end - device_name) + 2;
+                result = malloc(length);
+                if (!result) handle_error("Memory allocation failed");
+                snprintf(result, length, "%.*s %.*s", (int)(vendor_end - vendor_name), vendor_name,
+                         (int)(device_end - device_name), device_name);
+                break;
+            }
+            line = memchr(line + 1, '\n', end - line - 1);
+        }
+    }
+
+    munmap(data, size);
+    return result;
+}
+
+// Function to list the GPUs driven by DRM with their names and kernel drivers
+char* get_gpu_info() {
+    DIR* dir = io_opendir("/sys/class/drm");
+    if (!dir) return NULL;
+
+    struct buffer out = { 0 };
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        // cardN is the device, cardN-HDMI-A-1 and friends are its connectors
+        if (strncmp(entry->d_name, "card", 4) != 0 || strchr(entry->d_name, '-')) continue;
+
+        char path[PATH_MAX];
+        char buf[32];
+        unsigned vendor_id = 0, device_id = 0;
+        snprintf(path, sizeof(path), "/sys/class/drm/%s/device/vendor", entry->d_name);
+        if (read_file(path, buf, sizeof(buf)) > 0) vendor_id = strtoul(buf, NULL, 16);
+        snprintf(path, sizeof(path), "/sys/class/drm/%s/device/device", entry->d_name);
+        if (read_file(path, buf, sizeof(buf)) > 0) device_id = strtoul(buf, NULL, 16);
+
+        char driver[PATH_MAX] = "";
+        snprintf(path, sizeof(path), "/sys/class/drm/%s/device/driver", entry->d_name);
+        ssize_t length = io_readlink(path, driver, sizeof(driver) - 1);
+        if (length > 0) driver[length] = '\0';
+        const char* driver_name = strrchr(driver, '/') ? strrchr(driver, '/') + 1 : driver;
+
+        char* name = vendor_id ? lookup_pci_name(vendor_id, device_id) : NULL;
+        if (out.length) buffer_append(&out, ", ", 2);
+        // Platform devices such as simpledrm have no PCI IDs, the driver alone names them
+        if (name) {
+            buffer_printf(&out, "%s", name);
+        } else if (vendor_id) {
+            buffer_printf(&out, "%04x:%04x", vendor_id, device_id);
+        } else {
+            buffer_printf(&out, "%s", *driver_name ? driver_name : entry->d_name);
+        }
+        if (*driver_name && (name || vendor_id)) buffer_printf(&out, " [%s]", driver_name);
+        free(name);
+    }
+
+    closedir(dir);
+    return out.data;
+}
+
+// Load counters of one GPU, held open so every tick costs one pread per counter
+struct gpu_monitor {
+    char card[NAME_MAX + 1];
+    int runtime_status_fd;
+    int busy_fd;
+    int vram_used_fd;
+    int vram_total_fd;
+    int freq_fd;
+    int max_freq_fd;
+};
+
+// The GPUs watched by long-running modes, one-shot runs leave this disabled
+static struct {
+    struct gpu_monitor gpus[MAX_GPUS];
+    size_t count;
+    int enabled;
+} gpu_monitors;
+
+// Function to open the first of several sysfs counters below a card that exists, -1 if none does
+int open_gpu_counter(const char* card, const char* const* paths, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "/sys/class/drm/%s/%s", card, paths[i]);
+        int fd = io_open(path, O_RDONLY | O_CLOEXEC, NULL);
+        if (fd != -1) return fd;
+    }
+    return -1;
+}
+
+// Function to discover the load counters of every GPU, called once by the watch, live and daemon modes
+void enable_gpu_monitors() {
+    // amdgpu reports load and VRAM, i915 and xe only their actual and maximum frequencies
+    static const char* const runtime_status[] = { "device/power/runtime_status" };
+    static const char* const busy[] = { "device/gpu_busy_percent" };
+    static const char* const vram_used[] = { "device/mem_info_vram_used" };
+    static const char* const vram_total[] = { "device/mem_info_vram_total" };
+    static const char* const freq[] = { "gt_act_freq_mhz", "device/tile0/gt0/freq0/act_freq" };
+    static const char* const max_freq[] = { "gt_max_freq_mhz", "device/tile0/gt0/freq0/max_freq" };
+
+    gpu_monitors.enabled = 1;
+    DIR* dir = io_opendir("/sys/class/drm");
+    if (!dir) return;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) && gpu_monitors.count < MAX_GPUS) {
+        if (strncmp(entry->d_name, "card", 4) != 0 || strchr(entry->d_name, '-')) continue;
+
+        struct gpu_monitor* gpu = &gpu_monitors.gpus[gpu_monitors.count];
+        snprintf(gpu->card, sizeof(gpu->card), "%s", entry->d_name);
+        gpu->runtime_status_fd = open_gpu_counter(gpu->card, runtime_status, 1);
+        gpu->busy_fd = open_gpu_counter(gpu->card, busy, 1);
+        gpu->vram_used_fd = open_gpu_counter(gpu->card, vram_used, 1);
+        gpu->vram_total_fd = open_gpu_counter(gpu->card, vram_total, 1);
+        gpu->freq_fd = open_gpu_counter(gpu->card, freq, 2);
+        gpu->max_freq_fd = open_gpu_counter(gpu->card, max_freq, 2);
+        if (gpu->busy_fd != -1 || gpu->vram_used_fd != -1 || gpu->freq_fd != -1) {
+            gpu_monitors.count++;
+        } else if (gpu->runtime_status_fd != -1) {
+            close(gpu->runtime_status_fd);
+        }
+    }
+    closedir(dir);
+}
+
+// Function to read a held-open sysfs counter from its start, -1 if it cannot be read
+long long read_gpu_counter(int fd) {
+    char buf[32];
+    if (fd == -1) return -1;
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    return strtoll(buf, NULL, 10);
+}
+
+// Function to tell whether a GPU is runtime suspended, reading the power state does not wake it
+int gpu_is_suspended(const struct gpu_monitor* gpu) {
+    char buf[16];
+    if (gpu->runtime_status_fd == -1) return 0;
+    ssize_t n = pread(gpu->runtime_status_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    return strncmp(buf, "suspend", 7) == 0;
+}
+
+// Function to describe the current load of every monitored GPU
+char* get_gpu_load() {
+    if (!gpu_monitors.enabled) return NULL;
+
+    struct buffer out = { 0 };
+    for (size_t i = 0; i < gpu_monitors.count; i++) {
+        const struct gpu_monitor* gpu = &gpu_monitors.gpus[i];
+
+        // Reading the counters of a runtime-suspended card powers it up again, an idle dGPU is left asleep
+        if (gpu_is_suspended(gpu)) {
+            if (out.length) buffer_append(&out, ", ", 2);
+            if (gpu_monitors.count > 1) buffer_printf(&out, "%s ", gpu->card);
+            buffer_printf(&out, "suspended");
+            continue;
+        }
+
+        long long busy = read_gpu_counter(gpu->busy_fd);
+        long long vram_used = read_gpu_counter(gpu->vram_used_fd);
+        long long vram_total = read_gpu_counter(gpu->vram_total_fd);
+        long long freq = read_gpu_counter(gpu->freq_fd);
+        long long max_freq = read_gpu_counter(gpu->max_freq_fd);
+
+        size_t start = out.length;
+        if (start) buffer_append(&out, ", ", 2);
+        if (gpu_monitors.count > 1) buffer_printf(&out, "%s ", gpu->card);
+        size_t empty = out.length;
+        if (busy >= 0) buffer_printf(&out, "%lld%%", busy);
+        if (vram_used >= 0 && vram_total > 0) {
+            char used[32];
+            char total[32];
+            format_size(vram_used, used, sizeof(used));
+            format_size(vram_total, total, sizeof(total));
+            buffer_printf(&out, "%s%s / %s VRAM", out.length > empty ? ", " : "", used, total);
+        }
+        if (freq >= 0) {
+            buffer_printf(&out, "%s%lld", out.length > empty ? ", " : "", freq);
+            if (max_freq > 0) buffer_printf(&out, "/%lld", max_freq);
+            buffer_printf(&out, " MHz");
+        }
+        // A card without a readable counter leaves no trace, its separator and name are cut off again
+        if (out.length == empty) {
+            out.length = start;
+            out.data[start] = '\0';
+        }
+    }
+    if (out.data && !out.length) {
+        free(out.data);
+        return NULL;
+    }
+    return out.data;
+}
+
+// A pure function to name an SMBIOS memory type, NULL for the ones not worth showing
+const char* smbios_memory_type(uint8_t type) {
+    switch (type) {
+    case 0x0F: return "SDRAM";
+    case 0x12: return "DDR";
+    case 0x13: return "DDR2";
+    case 0x14: return "DDR2 FB-DIMM";
+    case 0x18: return "DDR3";
+    case 0x1A: return "DDR4";
+    case 0x1B: return "LPDDR";
+    case 0x1C: return "LPDDR2";
+    case 0x1D: return "LPDDR3";
+    case 0x1E: return "LPDDR4";
+    case 0x20: return "HBM";
+    case 0x21: return "HBM2";
+    case 0x22: return "DDR5";
+    case 0x23: return "LPDDR5";
+    case 0x24: return "HBM3";
+    default: return NULL;
+    }
+}
+
+// Installed memory modules, identical ones are counted together
+struct memory_module {
+    unsigned long long bytes;
+    const char* type;
+    unsigned speed;
+    unsigned count;
+};
+
+// A pure function to summarize the memory device (type 17) structures of a raw SMBIOS table
+char* parse_memory_devices(const unsigned char* table, size_t size) {
+    struct memory_module modules[16];
+    size_t module_count = 0;
+
+    size_t offset = 0;
+    while (offset + 4 <= size) {
+        const unsigned char* entry = table + offset;
+        uint8_t type = entry[0];
+        uint8_t length = entry[1];
+        if (length < 4 || offset + length > size) break;
+
+        // The formatted area is followed by its strings, which end with an empty one
+        size_t next = offset + length;
+        while (next + 1 < size && (table[next] || table[next + 1])) next++;
+        next += 2;
+
+        if (type == 127) break;
+        if (type == 17 && length >= 0x15) {
+            uint16_t size_field = entry[0x0C] | entry[0x0D] << 8;
+            unsigned long long bytes = 0;
+            if (size_field == 0x7FFF && length >= 0x20) {
+                uint32_t extended = entry[0x1C] | entry[0x1D] << 8 | entry[0x1E] << 16 | (uint32_t)entry[0x1F] << 24;
+                bytes = (unsigned long long)(extended & 0x7FFFFFFF) << 20;
+            } else if (size_field != 0 && size_field != 0xFFFF) {
+                bytes = size_field & 0x8000 ? (unsigned long long)(size_field & 0x7FFF) << 10
+                                            : (unsigned long long)size_field << 20;
+            }
+
+            // The configured speed is what the module runs at, the rated speed is the fallback
+            unsigned speed = 0;
+            if (length >= 0x22) speed = entry[0x20] | entry[0x21] << 8;
+            if ((!speed || speed == 0xFFFF) && length >= 0x17) speed = entry[0x15] | entry[0x16] << 8;
+            if (speed == 0xFFFF && length >= 0x58) {
+                speed = entry[0x54] | entry[0x55] << 8 | entry[0x56] << 16 | (unsigned)entry[0x57] << 24;
+            }
+            if (speed == 0xFFFF) speed = 0;
+
+            // Empty slots report a size of zero
+            if (bytes) {
+                const char* type_name = smbios_memory_type(entry[0x12]);
+                size_t i = 0;
+                while (i < module_count && !(modules[i].bytes == bytes && modules[i].speed == speed &&
+                                             modules[i].type == type_name)) {
+                    i++;
+                }
+                if (i < module_count) {
+                    modules[i].count++;
+                } else if (module_count < sizeof(modules) / sizeof(modules[0])) {
+                    modules[module_count++] = (struct memory_module){ bytes, type_name, speed, 1 };
+                }
+            }
+        }
+        offset = next;
+    }
+
+    struct buffer out = { 0 };
+    for (size_t i = 0; i < module_count; i++) {
+        char size_text[32];
+        format_size(modules[i].bytes, size_text, sizeof(size_text));
+        buffer_printf(&out, "%s%ux %s", i ? " + " : "", modules[i].count, size_text);
+        if (modules[i].type) buffer_printf(&out, " %s", modules[i].type);
+        if (modules[i].speed) buffer_printf(&out, " @ %u MT/s", modules[i].speed);
+    }
+    return out.data;
+}
+
+// Function to describe the installed memory modules from the SMBIOS table, readable by root only
+char* get_memory_modules() {
+    size_t limit;
+    int fd = io_open("/sys/firmware/dmi/tables/DMI", O_RDONLY | O_CLOEXEC, &limit);
+    if (fd == -1) return NULL;
+
+    // The attribute reports the table size, so a single read takes all of it
+    struct stat st;
+    char* result = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        size_t size = (size_t)st.st_size < limit ? (size_t)st.st_size : limit;
+        unsigned char* table = malloc(size);
+        if (!table) handle_error("Memory allocation failed");
+        ssize_t n = pread(fd, table, size, 0);
+        if (n > 0) result = parse_memory_devices(table, n);
+        free(table);
+    }
+
+    close(fd);
+    return result;
+}
+
+// Function to read a small file below a directory into a NUL-terminated buffer with trailing whitespace removed
+ssize_t read_file_at(int dir_fd, const char* dir_path, const char* path, char* buf, size_t size) {
+    size_t limit;
+    int fd = io_openat(dir_fd, dir_path, path, O_RDONLY | O_CLOEXEC, &limit);
+    if (fd == -1) return -1;
+    if (limit < size - 1) size = limit + 1;
+
+    ssize_t n;
+    while ((n = read(fd, buf, size - 1)) == -1 && errno == EINTR) {}
+    close(fd);
+    if (n < 0) return -1;
+
+    while (n > 0 && isspace((unsigned char)buf[n - 1])) n--;
+    buf[n] = '\0';
+    return n;
+}
+
+// A pure function to name the bus a block device hangs off, judged by its path in the device tree
+const char* block_transport(const char* device_path) {
+    static const struct {
+        const char* marker;
+        const char* name;
+    } transports[] = {
+        { "/nvme", "NVMe" }, { "/usb", "USB" }, { "/mmc_host/", "MMC" }, { "/virtio", "virtio" },
+        { "/ata", "SATA" },  { "/host", "SCSI" }, { "/xen", "Xen" },
+    };
+    for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]); i++) {
+        if (strstr(device_path, transports[i].marker)) return transports[i].name;
+    }
+    return NULL;
+}
+
+// Function to list the physical disks with model, size, kind and transport
+char* get_storage_info() {
+    // Virtual devices, snaps alone can leave hundreds of loop devices behind
+    static const char* const skipped[] = { "loop", "ram", "dm-", "zram", "md", "nbd" };
+
+    int block_fd = io_open("/sys/block", O_RDONLY | O_DIRECTORY | O_CLOEXEC, NULL);
+    if (block_fd == -1) return NULL;
+    DIR* dir = fdopendir(dup(block_fd));
+    if (!dir) {
+        close(block_fd);
+        return NULL;
+    }
+
+    struct buffer out = { 0 };
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        const char* name = entry->d_name;
+        if (name[0] == '.') continue;
+        int skip = 0;
+        for (size_t i = 0; !skip && i < sizeof(skipped) / sizeof(skipped[0]); i++) {
+            skip = strncmp(name, skipped[i], strlen(skipped[i])) == 0;
+        }
+        if (skip) continue;
+
+        // Every attribute is read relative to the device directory, without resolving /sys/block again
+        int dev_fd = io_openat(block_fd, "/sys/block", name, O_RDONLY | O_DIRECTORY | O_CLOEXEC, NULL);
+        if (dev_fd == -1) continue;
+
+        char dir_path[PATH_MAX];
+        char buf[256];
+        snprintf(dir_path, sizeof(dir_path), "/sys/block/%s", name);
+        unsigned long long sectors = read_file_at(dev_fd, dir_path, "size", buf, sizeof(buf)) > 0
+                                         ? strtoull(buf, NULL, 10) : 0;
+
+        // Card readers and optical drives without a medium report no sectors
+        if (sectors) {
+            char model[256] = "";
+            if (read_file_at(dev_fd, dir_path, "device/model", model, sizeof(model)) <= 0) {
+                read_file_at(dev_fd, dir_path, "device/name", model, sizeof(model));
+            }
+            int rotational = read_file_at(dev_fd, dir_path, "queue/rotational", buf, sizeof(buf)) > 0 && buf[0] == '1';
+
+            char link[PATH_MAX];
+            ssize_t length = io_readlinkat(block_fd, "/sys/block", name, link, sizeof(link) - 1);
+            link[length > 0 ? length : 0] = '\0';
+            const char* transport = block_transport(link);
+
+            char size_text[32];
+            format_size(sectors * 512, size_text, sizeof(size_text));
+            if (out.length) buffer_append(&out, ", ", 2);
+            buffer_printf(&out, "%s (%s, ", model[0] ? model : name, size_text);
+            if (strncmp(name, "nvme", 4) == 0) {
+                buffer_printf(&out, "NVMe");
+            } else {
+                buffer_printf(&out, "%s", rotational ? "HDD" : "SSD");
+                if (transport) buffer_printf(&out, ", %s", transport);
+            }
+            buffer_append(&out, ")", 1);
+        }
+        close(dev_fd);
+    }
+
+    closedir(dir);
+    close(block_fd);
+    return out.data;
+}
+
+// Function to find the last line of a log containing a marker, reading backwards from the end in fixed chunks
+// The line is copied to line, returns its length or -1 if none was found within LOG_SCAN_LIMIT bytes
+ssize_t find_last_log_line(const char* path, const char* marker, char* line, size_t size) {
+    size_t limit;
+    int fd = io_open(path, O_RDONLY | O_CLOEXEC, &limit);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    off_t position = (size_t)st.st_size < limit ? st.st_size : (off_t)limit;
+    off_t stop = position > LOG_SCAN_LIMIT ? position - LOG_SCAN_LIMIT : 0;
+
+    // A chunk followed by the start of the line the previous chunk began in the middle of
+    char* buf = malloc(LOG_CHUNK_SIZE + MAX_LINE_LENGTH);
+    if (!buf) handle_error("Memory allocation failed");
+    size_t carry = 0;
+    ssize_t result = -1;
+
+    size_t marker_length = strlen(marker);
+    while (result == -1 && position > stop) {
+        size_t chunk = position - stop < LOG_CHUNK_SIZE ? position - stop : LOG_CHUNK_SIZE;
+        position -= chunk;
+        memmove(buf + chunk, buf, carry);
+        if (pread(fd, buf, chunk, position) != (ssize_t)chunk) break;
+
+        size_t end = chunk + carry;
+        for (;;) {
+            char* newline = memrchr(buf, '\n', end);
+            if (!newline && position > stop) break;
+
+            const char* start = newline ? newline + 1 : buf;
+            size_t length = buf + end - start;
+            if (length >= marker_length && memmem(start, length, marker, marker_length)) {
+                if (length >= size) length = size - 1;
+                memcpy(line, start, length);
+                line[length] = '\0';
+                result = length;
+                break;
+            }
+            if (!newline) break;
+            end = newline - buf;
+        }
+
+        // Lines longer than the carry space are not log entries worth finding
+        carry = end <= MAX_LINE_LENGTH ? end : 0;
+    }
+
+    free(buf);
+    close(fd);
+    return result;
+}
+
+// A pure function to describe how long ago something happened in the largest fitting unit
+void format_age(long long seconds, char* buf, size_t size) {
+    static const struct {
+        long long seconds;
+        const char* unit;
+    } units[] = { { 86400 * 365, "year" }, { 86400 * 30, "month" }, { 86400 * 7, "week" },
+                  { 86400, "day" },        { 3600, "hour" },        { 60, "minute" } };
+
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+        long long count = seconds / units[i].seconds;
+        if (count > 0) {
+            snprintf(buf, size, "%lld %s%s ago", count, units[i].unit, count == 1 ? "" : "s");
+            return;
+        }
+    }
+    snprintf(buf, size, "just now");
+}
+
+// A pure function to parse a log timestamp YYYY-MM-DD[T ]HH:MM[:SS][Z|+hhmm|+hh:mm] into a time
+// Stamps without a UTC offset are in local time
+int parse_log_stamp(const char* stamp, time_t* when) {
+    struct tm tm = { 0 };
+    const char* rest = strptime(stamp, "%Y-%m-%d", &tm);
+    if (!rest || (*rest != 'T' && *rest != ' ')) return -1;
+    rest = strptime(rest + 1, "%H:%M", &tm);
+    if (!rest) return -1;
+    if (*rest == ':') {
+        rest = strptime(rest + 1, "%S", &tm);
+        if (!rest) return -1;
+    }
+
+    long offset;
+    if (*rest == 'Z') {
+        offset = 0;
+    } else if ((*rest == '+' || *rest == '-') && isdigit((unsigned char)rest[1]) && isdigit((unsigned char)rest[2])) {
+        const char* minutes = rest[3] == ':' ? rest + 4 : rest + 3;
+        if (!isdigit((unsigned char)minutes[0]) || !isdigit((unsigned char)minutes[1])) return -1;
+        offset = ((rest[1] - '0') * 10 + rest[2] - '0') * 3600 + ((minutes[0] - '0') * 10 + minutes[1] - '0') * 60;
+        if (*rest == '-') offset = -offset;
+    } else {
+        tm.tm_isdst = -1;
+        *when = mktime(&tm);
+        return *when == (time_t)-1 ? -1 : 0;
+    }
+
+    *when = timegm(&tm) - offset;
+    return 0;
+}
+
+// Function to get when the last package upgrade happened, from the tail of the package manager log
+char* get_last_update() {
+    // Each log timestamps its lines as parse_log_stamp reads them, pacman wraps it in brackets
+    static const struct {
+        const char* path;
+        const char* marker;
+    } logs[] = {
+        { "/var/log/pacman.log", "] [ALPM] upgraded " },
+        { "/var/log/dpkg.log", " upgrade " },
+        { "/var/log/dnf.rpm.log", " Upgrade" },
+    };
+
+    char line[MAX_LINE_LENGTH];
+    for (size_t i = 0; i < sizeof(logs) / sizeof(logs[0]); i++) {
+        if (find_last_log_line(logs[i].path, logs[i].marker, line, sizeof(line)) <= 0) continue;
+
+        // A line that does not parse says nothing about this log, the next one may still know
+        time_t when;
+        if (parse_log_stamp(line[0] == '[' ? line + 1 : line, &when) == -1) continue;
+
+        struct tm tm;
+        char date[32];
+        char age[32];
+        localtime_r(&when, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+        format_age(time(NULL) - when, age, sizeof(age));
+
+        struct buffer out = { 0 };
+        buffer_printf(&out, "%s (%s)", date, age);
+        return out.data;
+    }
+    return NULL;
+}
+
+// Function to find the latest login of a user in a wtmp file, reading whole records backwards from the end
+// The newest login on skip_line is the current session and is passed over, older logins there still count
+// Returns 0 and fills record when one was found within the last WTMP_MAX_RECORDS records
+int find_last_login(const char* path, const char* user, const char* skip_line, struct utmp* record) {
+    size_t limit;
+    int fd = io_open(path, O_RDONLY | O_CLOEXEC, &limit);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    off_t position = fstat(fd, &st) == 0 ? ((size_t)st.st_size < limit ? st.st_size : (off_t)limit) : 0;
+
+    // A torn record at the end from a crashed writer is ignored, every read then starts on a record boundary
+    position -= position % sizeof(struct utmp);
+
+    struct utmp* records = malloc(WTMP_CHUNK_RECORDS * sizeof(struct utmp));
+    if (!records) handle_error("Memory allocation failed");
+    int result = -1;
+    size_t scanned = 0;
+    while (result == -1 && position > 0 && scanned < WTMP_MAX_RECORDS) {
+        size_t count = position / sizeof(struct utmp);
+        if (count > WTMP_CHUNK_RECORDS) count = WTMP_CHUNK_RECORDS;
+        position -= count * sizeof(struct utmp);
+        scanned += count;
+        if (pread(fd, records, count * sizeof(struct utmp), position) != (ssize_t)(count * sizeof(struct utmp))) break;
+
+        for (size_t i = count; i-- > 0;) {
+            const struct utmp* entry = &records[i];
+            if (entry->ut_type != USER_PROCESS) continue;
+            if (strncmp(entry->ut_user, user, sizeof(entry->ut_user)) != 0) continue;
+            if (skip_line && strncmp(entry->ut_line, skip_line, sizeof(entry->ut_line)) == 0) {
+                skip_line = NULL;
+                continue;
+            }
+            *record = *entry;
+            result = 0;
+            break;
+        }
+    }
+
+    free(records);
+    close(fd);
+    return result;
+}
+
+// Function to get the time and origin of the previous login of the current user, seen from a session on tty
+// tty is the line without "/dev/", NULL when the session has no terminal
+char* get_last_login_on(const char* tty) {
+    struct passwd* pw = getpwuid(getuid());
+    if (!pw) return NULL;
+
+    // wtmp only changes on logins and logouts, so watch ticks and daemon requests reuse earlier answers until then
+    // The daemon asks on behalf of every terminal it serves, so each tty keeps its own slot
+    static struct {
+        uint64_t key;
+        char* value;
+    } slots[LAST_LOGIN_CACHE_SLOTS];
+    static size_t next_slot;
+    struct stat st;
+    if (io_stat(_PATH_WTMP, &st) == -1) return NULL;
+    uint64_t key = hash_bytes(HASH_SEED, &st.st_ino, sizeof(st.st_ino));
+    key = hash_bytes(key, &st.st_size, sizeof(st.st_size));
+    key = hash_bytes(key, &st.st_mtim, sizeof(st.st_mtim));
+    key = hash_bytes(key, pw->pw_name, strlen(pw->pw_name) + 1);
+    key = tty ? hash_bytes(key, tty, strlen(tty) + 1) : hash_bytes(key, "-", 1);
+    for (size_t i = 0; i < LAST_LOGIN_CACHE_SLOTS; i++) {
+        if (slots[i].key == key) return slots[i].value ? strdup(slots[i].value) : NULL;
+    }
+
+    size_t slot = next_slot++ % LAST_LOGIN_CACHE_SLOTS;
+    free(slots[slot].value);
+    slots[slot].value = NULL;
+    slots[slot].key = key;
+
+    struct utmp record;
+    if (find_last_login(_PATH_WTMP, pw->pw_name, tty, &record) == -1) return NULL;
+
+    time_t when = record.ut_tv.tv_sec;
+    struct tm tm;
+    char date[32];
+    localtime_r(&when, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+
+    struct buffer out = { 0 };
+    if (record.ut_host[0]) {
+        buffer_printf(&out, "%s from %.*s", date, (int)sizeof(record.ut_host), record.ut_host);
+    } else {
+        buffer_printf(&out, "%s on %.*s", date, (int)sizeof(record.ut_line), record.ut_line);
+    }
+    slots[slot].value = out.data ? strdup(out.data) : NULL;
+    return out.data;
+}
+
+// Function to get the previous login of the current user, the session this runs in is the latest login on its tty
+char* get_last_login() {
+    const char* tty = ttyname(STDIN_FILENO);
+    if (tty && strncmp(tty, "/dev/", 5) == 0) tty += 5;
+    return get_last_login_on(tty);
+}
+
+// Function to pad a D-Bus message being built to an alignment boundary
+void dbus_align(struct buffer* message, size_t alignment) {
+    static const char zeros[8] = { 0 };
+    buffer_append(message, zeros, (alignment - message->length % alignment) % alignment);
+}
+
+// Function to append a D-Bus string or object path: length, bytes and a terminating NUL
+void dbus_append_string(struct buffer* message, const char* str) {
+    uint32_t length = strlen(str);
+    dbus_align(message, 4);
+    buffer_append(message, (const char*)&length, 4);
+    buffer_append(message, str, length + 1);
+}
+
+// Function to append one header field, a code and a variant holding a string of the given type
+void dbus_append_field(struct buffer* message, uint8_t code, char type, const char* value) {
+    char signature[4] = { 1, type, 0 };
+    dbus_align(message, 8);
+    buffer_append(message, (const char*)&code, 1);
+    buffer_append(message, signature, 3);
+    if (type == 'g') {
+        uint8_t length = strlen(value);
+        buffer_append(message, (const char*)&length, 1);
+        buffer_append(message, value, length + 1);
+    } else {
+        dbus_append_string(message, value);
+    }
+}
+
+// Function to append a D-Bus method call in host byte order with an already marshalled body
+void dbus_append_call(struct buffer* out, uint32_t serial, const char* destination, const char* path,
+                      const char* interface, const char* member, const char* signature, const struct buffer* body) {
+    struct buffer message = { 0 };
+    uint32_t body_length = body ? body->length : 0;
+    // Integers are marshalled in host order, so the endianness mark has to name it
+    // NO_AUTO_START: a missing service is an answer, not something to launch
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    buffer_append(&message, "B\1\2\1", 4);
+#else
+    buffer_append(&message, "l\1\2\1", 4);
+#endif
+    buffer_append(&message, (const char*)&body_length, 4);
+    buffer_append(&message, (const char*)&serial, 4);
+    buffer_append(&message, "\0\0\0\0", 4);
+
+    dbus_append_field(&message, 1, 'o', path);
+    dbus_append_field(&message, 2, 's', interface);
+    dbus_append_field(&message, 3, 's', member);
+    dbus_append_field(&message, 6, 's', destination);
+    if (signature) dbus_append_field(&message, 8, 'g', signature);
+
+    // Padding is relative to the start of the message, so it is built on its own before being appended
+    // The header field array length excludes the padding before the body
+    uint32_t fields_length = message.length - 16;
+    memcpy(message.data + 12, &fields_length, 4);
+    dbus_align(&message, 8);
+    if (body) buffer_append(&message, body->data, body->length);
+
+    buffer_append(out, message.data, message.length);
+    free(message.data);
+}
+
+// A reader over a received D-Bus message, in the byte order the sender chose
+struct dbus_reader {
+    const unsigned char* data;
+    size_t length;
+    size_t offset;
+    int big_endian;
+};
+
+// Function to read an aligned 32-bit value, 0 past the end of the message
+uint32_t dbus_read_u32(struct dbus_reader* reader) {
+    reader->offset = (reader->offset + 3) & ~(size_t)3;
+    if (reader->offset + 4 > reader->length) {
+        reader->offset = reader->length;
+        return 0;
+    }
+    const unsigned char* p = reader->data + reader->offset;
+    reader->offset += 4;
+    if (reader->big_endian) return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    return (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+// Function to read a string or object path in place, NULL if it runs past the message
+const char* dbus_read_string(struct dbus_reader* reader) {
+    uint32_t length = dbus_read_u32(reader);
+    if (reader->offset + length + 1 > reader->length) {
+        reader->offset = reader->length;
+        return NULL;
+    }
+    const char* str = (const char*)reader->data + reader->offset;
+    reader->offset += length + 1;
+    return str;
+}
+
+// A pure function to get the size of the complete message at the start of data, 0 if more bytes are needed
+size_t dbus_message_size(const unsigned char* data, size_t length) {
+    if (length < 16) return 0;
+    struct dbus_reader reader = { data, length, 4, data[0] == 'B' };
+    uint32_t body_length = dbus_read_u32(&reader);
+    reader.offset = 12;
+    uint32_t fields_length = dbus_read_u32(&reader);
+    size_t size = 16 + (((size_t)fields_length + 7) & ~(size_t)7) + body_length;
+    return size <= length ? size : 0;
+}
+
+// Function to find the reply serial of a message, positioning the reader at its body
+uint32_t dbus_reply_serial(struct dbus_reader* reader) {
+    reader->offset = 12;
+    uint32_t fields_end = 16 + dbus_read_u32(reader);
+    uint32_t reply_serial = 0;
+    while (reader->offset < fields_end && reader->offset < reader->length) {
+        reader->offset = (reader->offset + 7) & ~(size_t)7;
+        if (reader->offset + 2 > fields_end) break;
+        uint8_t code = reader->data[reader->offset];
+        uint8_t signature_length = reader->data[reader->offset + 1];
+        if (reader->offset + 3 + signature_length > fields_end) break;
+        char type = reader->data[reader->offset + 2];
+        reader->offset += 3 + signature_length;
+
+        // Header fields hold strings, object paths, signatures or 32-bit integers
+        if (type == 'u') {
+            uint32_t value = dbus_read_u32(reader);
+            if (code == 5) reply_serial = value;
+        } else if (type == 'g') {
+            if (reader->offset >= reader->length) break;
+            reader->offset += reader->data[reader->offset] + 2;
+        } else {
+            dbus_read_string(reader);
+        }
+    }
+    reader->offset = (fields_end + 7) & ~(size_t)7;
+    return reply_serial;
+}
+
+// Function to summarize a ListUnits reply body, an array of (ssssssouso) whose first member is the unit name
+char* parse_failed_units(struct dbus_reader* reader) {
+    uint32_t array_length = dbus_read_u32(reader);
+    reader->offset = (reader->offset + 7) & ~(size_t)7;
+    size_t end = reader->offset + array_length;
+    if (end > reader->length) return NULL;
+
+    struct buffer names = { 0 };
+    unsigned count = 0;
+    while (reader->offset < end) {
+        reader->offset = (reader->offset + 7) & ~(size_t)7;
+        const char* name = dbus_read_string(reader);
+        for (int i = 0; i < 5; i++) dbus_read_string(reader);
+        dbus_read_string(reader);
+        dbus_read_u32(reader);
+        dbus_read_string(reader);
+        dbus_read_string(reader);
+        if (!name || reader->offset > end) break;
+
+        buffer_printf(&names, "%s%s", count ? ", " : "", name);
+        count++;
+    }
+
+    struct buffer out = { 0 };
+    if (count) {
+        buffer_printf(&out, "%u (%s)", count, names.data);
+    } else {
+        buffer_printf(&out, "None");
+    }
+    free(names.data);
+    return out.data;
+}
+
+// Function to write a whole buffer to a non-blocking socket, giving up at the deadline
+int write_until(int fd, const char* data, size_t length, long long deadline) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) {
+            struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+            long long remaining = deadline - monotonic_ms();
+            if (remaining <= 0 || poll(&pfd, 1, remaining) != 1) return -1;
+            continue;
+        }
+        if (n <= 0) return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+// Function to connect to the D-Bus system bus and authenticate as this uid, never blocking past the deadline
+int connect_system_bus(long long deadline) {
+    const char* address = getenv("DBUS_SYSTEM_BUS_ADDRESS");
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    const char* path = DBUS_SYSTEM_SOCKET;
+    if (address && strncmp(address, "unix:path=", 10) == 0) path = address + 10;
+    size_t path_length = strcspn(path, ",;");
+    if (path_length >= sizeof(addr.sun_path)) return -1;
+    memcpy(addr.sun_path, path, path_length);
+
+    // A hung bus with a full backlog refuses a non-blocking connect with EAGAIN instead of stalling it
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    int connected = io_connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    if (!connected && errno == EINPROGRESS) {
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+        long long remaining = deadline - monotonic_ms();
+        int error = -1;
+        socklen_t error_length = sizeof(error);
+        connected = remaining > 0 && poll(&pfd, 1, remaining) == 1 &&
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length) == 0 && error == 0;
+    }
+    if (!connected) {
+        close(fd);
+        return -1;
+    }
+
+    // EXTERNAL takes the uid as hex-encoded decimal digits, the credentials come from the socket
+    char uid[16];
+    char request[64];
+    int length = snprintf(uid, sizeof(uid), "%u", (unsigned)getuid());
+    int request_length = snprintf(request, sizeof(request), "%cAUTH EXTERNAL ", 0);
+    for (int i = 0; i < length; i++) request_length += sprintf(request + request_length, "%02x", uid[i]);
+    request_length += sprintf(request + request_length, "\r\n");
+
+    char reply[128];
+    size_t reply_length = 0;
+    if (write_until(fd, request, request_length, deadline) == 0) {
+        while (reply_length < sizeof(reply) - 1 && !memchr(reply, '\n', reply_length)) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            long long remaining = deadline - monotonic_ms();
+            if (remaining <= 0 || poll(&pfd, 1, remaining) != 1) break;
+            ssize_t n = read(fd, reply + reply_length, sizeof(reply) - 1 - reply_length);
+            if (n <= 0) break;
+            reply_length += n;
+        }
+    }
+    if (reply_length < 3 || strncmp(reply, "OK ", 3) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function to list the failed systemd units over a bare D-Bus connection, NULL without a reachable systemd
+char* get_failed_units() {
+    long long deadline = monotonic_ms() + DBUS_TIMEOUT_MS;
+    int fd = connect_system_bus(deadline);
+    if (fd == -1) return NULL;
+
+    // BEGIN, Hello and the call go out together, only the reply to the call matters
+    struct buffer out = { 0 };
+    struct buffer body = { 0 };
+    buffer_append(&out, "BEGIN\r\n", 7);
+    dbus_append_call(&out, 1, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "Hello", NULL,
+                     NULL);
+    uint32_t states_length = 4 + strlen("failed") + 1;
+    buffer_append(&body, (const char*)&states_length, 4);
+    dbus_append_string(&body, "failed");
+    dbus_append_call(&out, 2, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+                     "org.freedesktop.systemd1.Manager", "ListUnitsFiltered", "as", &body);
+
+    char* result = NULL;
+    struct buffer in = { 0 };
+    if (write_until(fd, out.data, out.length, deadline) == 0) {
+        int done = 0;
+        while (!done) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            long long remaining = deadline - monotonic_ms();
+            if (remaining <= 0 || poll(&pfd, 1, remaining) != 1) break;
+
+            char chunk[4096];
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) break;
+            buffer_append(&in, chunk, n);
+
+            size_t size;
+            while (!done && (size = dbus_message_size((unsigned char*)in.data, in.length))) {
+                struct dbus_reader reader = { (unsigned char*)in.data, size, 0, in.data[0] == 'B' };
+                if (dbus_reply_serial(&reader) == 2) {
+                    if (in.data[1] == 2) result = parse_failed_units(&reader);
+                    done = 1;
+                }
+                memmove(in.data, in.data + size, in.length - size);
+                in.length -= size;
+            }
+        }
+    }
+
+    close(fd);
+    free(out.data);
+    free(body.data);
+    free(in.data);
+    return result;
+}
+
+// Function to count the entries of a directory, ignoring dot files
+int count_directory_entries(const char* path) {
+    DIR* dir = io_opendir(path);
+    if (!dir) return 0;
+
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] != '.') count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Function to count installed packages per package manager
+char* get_package_counts() {
+    struct buffer out = { 0 };
+
+    size_t size;
+    char* status = map_file("/var/lib/dpkg/status", &size);
+    if (status) {
+        static const char installed[] = "\nStatus: install ok installed";
+        int count = 0;
+        const char* end = status + size;
+        for (const char* p = memmem(status, size, installed, sizeof(installed) - 1); p;
+             p = memmem(p + 1, end - p - 1, installed, sizeof(installed) - 1)) {
+            count++;
+        }
+        munmap(status, size);
+        if (count) buffer_printf(&out, "%d (dpkg)", count);
+    }
+
+    // ALPM_DB_VERSION sits next to the package directories
+    int pacman = count_directory_entries("/var/lib/pacman/local");
+    if (pacman > 1) buffer_printf(&out, "%s%d (pacman)", out.length ? ", " : "", pacman - 1);
+
+    int flatpak = count_directory_entries("/var/lib/flatpak/app");
+    if (flatpak) buffer_printf(&out, "%s%d (flatpak)", out.length ? ", " : "", flatpak);
+
+    int snap = count_directory_entries("/var/lib/snapd/snaps");
+    if (snap) buffer_printf(&out, "%s%d (snap)", out.length ? ", " : "", snap);
+
+    return out.data;
+}
+
+// A pure function to strip packaging decorations (epoch, revision, +dfsg) from a version
+void normalize_version(char* version) {
+    char* epoch = strchr(version, ':');
+    if (epoch) memmove(version, epoch + 1, strlen(epoch + 1) + 1);
+    version[strcspn(version, "-+~")] = '\0';
+}
+
+// Index of every path a package manager installed as "\npath\tvalue" lines, kept for the life of the process
+struct path_index {
+    struct buffer data;
+    uint64_t key;
+};
+
+static struct path_index dpkg_index;
+static struct path_index pacman_index;
+
+// Function to append one "path<TAB>value" line to a path index
+void index_path(struct buffer* index, const char* prefix, const char* path, size_t path_length, const char* value,
+                size_t value_length) {
+    buffer_append(index, prefix, strlen(prefix));
+    buffer_append(index, path, path_length);
+    buffer_append(index, "\t", 1);
+    buffer_append(index, value, value_length);
+    buffer_append(index, "\n", 1);
+}
+
+// Function to append the paths of one dpkg file list to the index, valued with the package name
+void index_dpkg_list(const char* name, struct buffer* index) {
+    char list_path[PATH_MAX];
+    size_t size;
+    snprintf(list_path, sizeof(list_path), "/var/lib/dpkg/info/%s", name);
+    char* files = map_file(list_path, &size);
+    if (!files) return;
+
+    // "name:arch.list" names the package, the architecture is not part of it
+    size_t package_length = strcspn(name, ":");
+    if (package_length > strlen(name) - 5) package_length = strlen(name) - 5;
+
+    for (char* line = files; line < files + size;) {
+        char* newline = memchr(line, '\n', files + size - line);
+        char* end = newline ? newline : files + size;
+        if (end > line) index_path(index, "", line, end - line, name, package_length);
+        line = end + 1;
+    }
+    munmap(files, size);
+}
+
+// Function to index every dpkg file list
+int build_dpkg_index(struct buffer* index) {
+    DIR* dir = io_opendir("/var/lib/dpkg/info");
+    if (!dir) return -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        size_t length = strlen(entry->d_name);
+        if (length >= 6 && strcmp(entry->d_name + length - 5, ".list") == 0) index_dpkg_list(entry->d_name, index);
+    }
+    closedir(dir);
+    return 0;
+}
+
+// Function to append the files of one pacman package to the index, valued with the package version
+void index_pacman_package(const char* name, struct buffer* index) {
+    char entry_path[PATH_MAX];
+    char desc[4096];
+    snprintf(entry_path, sizeof(entry_path), "/var/lib/pacman/local/%s/desc", name);
+    if (read_file(entry_path, desc, sizeof(desc)) <= 0) return;
+    char* version = strstr(desc, "%VERSION%\n");
+    if (!version) return;
+    version += strlen("%VERSION%\n");
+    size_t version_length = strcspn(version, "\n");
+
+    size_t size;
+    snprintf(entry_path, sizeof(entry_path), "/var/lib/pacman/local/%s/files", name);
+    char* files = map_file(entry_path, &size);
+    if (!files) return;
+
+    // The %FILES% section lists paths without the leading slash, one per line, directories end in a slash
+    const char* section = memmem(files, size, "%FILES%\n", 8);
+    for (const char* line = section ? section + 8 : files + size; line < files + size;) {
+        const char* newline = memchr(line, '\n', files + size - line);
+        const char* end = newline ? newline : files + size;
+        if (end == line) break;
+        if (end[-1] != '/') index_path(index, "/", line, end - line, version, version_length);
+        line = end + 1;
+    }
+    munmap(files, size);
+}
+
+// Function to index the file lists of every installed pacman package
+int build_pacman_index(struct buffer* index) {
+    DIR* dir = io_opendir("/var/lib/pacman/local");
+    if (!dir) return -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] != '.') index_pacman_package(entry->d_name, index);
+    }
+    closedir(dir);
+    return 0;
+}
+
+// Function to load a path index, from the cache while the package database directory is unchanged
+int load_path_index(struct path_index* index, const char* db_dir, const char* cache_name,
+                    int (*build)(struct buffer*)) {
+    // Installing or removing a package adds or replaces an entry of the directory, which touches it
+    struct stat st;
+    if (io_stat(db_dir, &st) == -1) return -1;
+    uint64_t key = hash_bytes(HASH_SEED, &st.st_mtim, sizeof(st.st_mtim));
+    if (index->data.length && index->key == key) return 0;
+    index->data.length = 0;
+    index->key = key;
+
+    char path[PATH_MAX];
+    size_t size;
+    int have_path = get_cache_path(cache_name, path, sizeof(path)) == 0;
+    char* cached = have_path ? map_file(path, &size) : NULL;
+    if (cached) {
+        char* end = NULL;
+        if (size > 17 && strtoull(cached, &end, 16) == key && end == cached + 16 && *end == '\n') {
+            buffer_append(&index->data, cached + 16, size - 16);
+        }
+        munmap(cached, size);
+        if (index->data.length) return 0;
+    }
+
+    // Every file list is read once here instead of once per looked up path
+    buffer_append(&index->data, "\n", 1);
+    if (build(&index->data) == -1) {
+        index->data.length = 0;
+        return -1;
+    }
+    if (!have_path) return 0;
+
+    char tmp_path[PATH_MAX + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long)getpid());
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) return 0;
+    fprintf(file, "%016llx", (unsigned long long)key);
+    fwrite(index->data.data, 1, index->data.length, file);
+    if (fclose(file) == 0) {
+        rename(tmp_path, path);
+    } else {
+        unlink(tmp_path);
+    }
+    return 0;
+}
+
+// A pure function to find the value recorded for a path in a loaded index, NULL if it is not listed
+char* find_indexed_path(const struct path_index* index, const char* path) {
+    char needle[PATH_MAX + 2];
+    int length = snprintf(needle, sizeof(needle), "\n%s\t", path);
+    if (length < 0 || (size_t)length >= sizeof(needle)) return NULL;
+
+    const char* match = memmem(index->data.data, index->data.length, needle, length);
+    if (!match) return NULL;
+    match += length;
+    char* value = strndup(match, strcspn(match, "\n"));
+    if (!value) handle_error("Memory allocation failed");
+    return value;
+}
+
+// Function to find the version of the pacman package owning a file through the path index
+char* get_pacman_version(const char* path) {
+    if (load_path_index(&pacman_index, "/var/lib/pacman/local", "pacman-index", build_pacman_index) == -1) {
+        return NULL;
+    }
+    return find_indexed_path(&pacman_index, path);
+}
+
+// Function to find the dpkg package owning a path through the path index
+char* find_dpkg_owner(const char* path) {
+    if (load_path_index(&dpkg_index, "/var/lib/dpkg/info", "dpkg-index", build_dpkg_index) == -1) return NULL;
+    return find_indexed_path(&dpkg_index, path);
+}
+
+// Function to look up the installed version of a dpkg package in the status database
+char* get_dpkg_version(const char* package) {
+    size_t size;
+    char* status = map_file("/var/lib/dpkg/status", &size);
+    if (!status) return NULL;
+
+    char needle[MAX_LINE_LENGTH];
+    int needle_length = snprintf(needle, sizeof(needle), "\nPackage: %s\n", package);
+    char* result = NULL;
+
+    const char* stanza = NULL;
+    if (size > (size_t)needle_length && memcmp(status, needle + 1, needle_length - 1) == 0) {
+        stanza = status;
+    } else {
+        stanza = memmem(status, size, needle, needle_length);
+    }
+
+    if (stanza) {
+        const char* end = status + size;
+        const char* stanza_end = memmem(stanza + 1, end - stanza - 1, "\n\n", 2);
+        if (!stanza_end) stanza_end = end;
+
+        const char* version = memmem(stanza, stanza_end - stanza, "\nVersion: ", 10);
+        if (version) {
+            version += 10;
+            const char* eol = memchr(version, '\n', end - version);
+            result = strndup(version, (eol ? eol : end) - version);
+        }
+    }
+
+    munmap(status, size);
+    return result;
+}
+
+// Function to get the upstream version of the package that owns a file
+char* get_package_version(const char* path) {
+    char* version = get_pacman_version(path);
+
+    if (!version) {
+        char* package = find_dpkg_owner(path);
+        // Merged-/usr systems may list the file under its historical location
+        if (!package && strncmp(path, "/usr/", 5) == 0) package = find_dpkg_owner(path + 4);
+        if (package) {
+            version = get_dpkg_version(package);
+            free(package);
+        }
+    }
+
+    if (version) normalize_version(version);
+    return version;
+}
+
+// A pure function to check for characters that may appear in a version number
+int is_version_char(char c) {
+    return isdigit((unsigned char)c) || c == '.';
+}
+
+// Function to find a version string embedded in a binary after the given marker
+char* find_embedded_version(const char* path, const char* marker) {
+    size_t size;
+    const char* data = map_file(path, &size);
+    if (!data) return NULL;
+
+    const char* end = data + size;
+    size_t marker_length = strlen(marker);
+    char* result = NULL;
+
+    for (const char* hit = memmem(data, size, marker, marker_length); hit && !result;
+         hit = memmem(hit + 1, end - hit - 1, marker, marker_length)) {
+        // The version starts at the first digit of the marker or right after it
+        const char* start = hit;
+        while (start < hit + marker_length && !isdigit((unsigned char)*start)) start++;
+        if (start == end || !isdigit((unsigned char)*start)) continue;
+
+        const char* stop = start;
+        while (stop < end && stop - start < MAX_VERSION_LENGTH && is_version_char(*stop)) stop++;
+        if (stop > start && stop[-1] == '.') stop--;
+        if (stop - start < 3 || !memchr(start, '.', stop - start)) continue;
+
+        // Keep a pre-release tag such as "-nightly" or "-rc1"
+        if (stop < end && *stop == '-') {
+            const char* tag = stop + 1;
+            while (tag < end && tag - start < MAX_VERSION_LENGTH && isalnum((unsigned char)*tag)) tag++;
+            if (tag > stop + 1) stop = tag;
+        }
+
+        result = strndup(start, stop - start);
+    }
+
+    munmap((void*)data, size);
+    return result;
+}
+
+// Function to get the version of a binary, cached by its inode so it is derived once per install
+char* get_binary_version(const char* path, const char* marker) {
+    struct stat st;
+    if (io_stat(path, &st) == -1) return NULL;
+
+    uint64_t key = hash_bytes(HASH_SEED, &st.st_dev, sizeof(st.st_dev));
+    key = hash_bytes(key, &st.st_ino, sizeof(st.st_ino));
+    key = hash_bytes(key, &st.st_mtim, sizeof(st.st_mtim));
+    if (marker) key = hash_bytes(key, marker, strlen(marker));
+
+    char cache_name[NAME_MAX];
+    const char* base = strrchr(path, '/');
+    snprintf(cache_name, sizeof(cache_name), "version-%s", base ? base + 1 : path);
+
+    char* version = cache_load(cache_name, key);
+    if (version) {
+        // An empty entry records that nothing could be derived from this inode
+        if (*version) return version;
+        free(version);
+        return NULL;
+    }
+
+    char real_path[PATH_MAX];
+    if (!io_realpath(path, real_path)) snprintf(real_path, sizeof(real_path), "%s", path);
+
+    version = get_package_version(real_path);
+    if (!version && marker) version = find_embedded_version(real_path, marker);
+
+    cache_store(cache_name, key, version ? version : "");
+    return version;
+}
+
+// Runtimes reported on the Runtimes line and how to recognise their versions
+struct runtime {
+    const char* name;
+    const char* binaries[3];
+    const char* marker;
+    const char* version_file;
+};
+
+static const struct runtime runtimes[] = {
+    { "gcc", { "gcc", "cc" }, NULL, NULL },
+    { "clang", { "clang" }, "clang version ", NULL },
+    { "python", { "python3", "python" }, NULL, NULL },
+    { "node", { "node", "nodejs" }, "node.js/v", NULL },
+    { "go", { "go" }, "go1.", "../VERSION" },
+    { "rustc", { "rustc" }, "rustc version ", NULL },
+};
+
+#define RUNTIME_COUNT (sizeof(runtimes) / sizeof(runtimes[0]))
+
+// Function to check that a file is an ELF binary rather than a shim or wrapper script
+int is_elf_binary(const char* path) {
+    char magic[5];
+    return read_file(path, magic, sizeof(magic)) == 4 && memcmp(magic, "\x7f" "ELF", 4) == 0;
+}
+
+// Function to follow a rustup proxy to the binary of the active toolchain
+int resolve_rustup_proxy(const char* name, char* path, size_t size) {
+    char rustup_home[PATH_MAX];
+    const char* home = getenv("RUSTUP_HOME");
+    if (home) {
+        snprintf(rustup_home, sizeof(rustup_home), "%s", home);
+    } else {
+        snprintf(rustup_home, sizeof(rustup_home), "%s/.rustup", get_env_or_default("HOME", ""));
+    }
+
+    char toolchain[MAX_LINE_LENGTH] = "";
+    const char* override = getenv("RUSTUP_TOOLCHAIN");
+    if (override) {
+        snprintf(toolchain, sizeof(toolchain), "%s", override);
+    } else {
+        char settings_path[PATH_MAX + 16];
+        char settings[4096];
+        snprintf(settings_path, sizeof(settings_path), "%s/settings.toml", rustup_home);
+        if (read_file(settings_path, settings, sizeof(settings)) > 0) {
+            char* line = strstr(settings, "default_toolchain");
+            char* value = line ? extract_quoted_string(strtok(line, "\n")) : NULL;
+            if (value) {
+                snprintf(toolchain, sizeof(toolchain), "%s", value);
+                free(value);
+            }
+        }
+    }
+    if (!toolchain[0]) return -1;
+
+    snprintf(path, size, "%s/toolchains/%s/bin/%s", rustup_home, toolchain, name);
+    return io_access(path, X_OK);
+}
+
+// Function to locate binaries on PATH, opening each directory once and probing it with fstatat
+void locate_runtimes(char paths[][PATH_MAX]) {
+    const char* env_path = getenv("PATH");
+    if (!env_path) return;
+
+    char* search = strdup(env_path);
+    if (!search) handle_error("Memory allocation failed");
+
+    size_t remaining = RUNTIME_COUNT;
+    char* save = NULL;
+    for (char* dir = strtok_r(search, ":", &save); dir && remaining; dir = strtok_r(NULL, ":", &save)) {
+        int dir_fd = io_open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC, NULL);
+        if (dir_fd == -1) continue;
+
+        for (size_t i = 0; i < RUNTIME_COUNT; i++) {
+            if (paths[i][0]) continue;
+
+            for (size_t j = 0; j < 3 && runtimes[i].binaries[j]; j++) {
+                struct stat st;
+                if (io_fstatat(dir_fd, dir, runtimes[i].binaries[j], &st, 0) == -1) continue;
+                if (!S_ISREG(st.st_mode) || !(st.st_mode & S_IXUSR)) continue;
+
+                snprintf(paths[i], PATH_MAX, "%s/%s", dir, runtimes[i].binaries[j]);
+                remaining--;
+                break;
+            }
+        }
+
+        close(dir_fd);
+    }
+
+    free(search);
+}
+
+// A pure function to find the version suffix of a binary name such as gcc-12 or python3.11
+// The digits must follow one of the runtime's own names, an empty string is returned otherwise
+const char* get_name_version(const struct runtime* runtime, const char* base) {
+    size_t length = strlen(base);
+    size_t start = length;
+    while (start > 0 && (isdigit((unsigned char)base[start - 1]) || base[start - 1] == '.')) start--;
+    if (start == length || !isdigit((unsigned char)base[start])) return "";
+
+    size_t name_end = start > 0 && base[start - 1] == '-' ? start - 1 : start;
+    const char* names[4] = { runtime->name, runtime->binaries[0], runtime->binaries[1], runtime->binaries[2] };
+    for (size_t i = 0; i < 4 && names[i]; i++) {
+        size_t name_length = strlen(names[i]);
+        if (name_end >= name_length && strncmp(base + name_end - name_length, names[i], name_length) == 0) {
+            return base + start;
+        }
+    }
+    return "";
+}
+
+// Function to get the version of one runtime found at the given path
+char* get_runtime_version(const struct runtime* runtime, const char* path) {
+    char real_path[PATH_MAX];
+    if (!io_realpath(path, real_path)) return NULL;
+
+    const char* base = strrchr(real_path, '/') + 1;
+    if (strcmp(base, "rustup") == 0) {
+        if (resolve_rustup_proxy(runtime->name, real_path, sizeof(real_path)) == -1) return NULL;
+        base = strrchr(real_path, '/') + 1;
+    }
+
+    // Shims dispatch to a version chosen at run time, nothing can be said without running them
+    if (!is_elf_binary(real_path)) return NULL;
+
+    if (runtime->version_file) {
+        char version_path[PATH_MAX * 2];
+        char buf[MAX_LINE_LENGTH];
+        snprintf(version_path, sizeof(version_path), "%.*s/%s",
+                 (int)(base - real_path - 1), real_path, runtime->version_file);
+        if (read_file(version_path, buf, sizeof(buf)) > 0) {
+            buf[strcspn(buf, "\n")] = '\0';
+            const char* version = buf + strcspn(buf, "0123456789");
+            if (*version) return strdup(version);
+        }
+    }
+
+    // A versioned file name like python3.11 narrows down the embedded string to look for
+    const char* name_version = get_name_version(runtime, base);
+    char marker[MAX_VERSION_LENGTH];
+    const char* search = runtime->marker;
+    if (!search && strchr(name_version, '.')) {
+        snprintf(marker, sizeof(marker), "%s.", name_version);
+        search = marker;
+    }
+
+    char* version = get_binary_version(real_path, search);
+    if (!version && *name_version) version = strdup(name_version);
+    return version;
+}
+
+// Function to get the versions of compilers and interpreters found on PATH
+char* get_runtimes() {
+    char paths[RUNTIME_COUNT][PATH_MAX];
+    memset(paths, 0, sizeof(paths));
+    locate_runtimes(paths);
+
+    char buf[MAX_LINE_LENGTH * 2] = "";
+    size_t length = 0;
+    for (size_t i = 0; i < RUNTIME_COUNT; i++) {
+        if (!paths[i][0]) continue;
+
+        char* version = get_runtime_version(&runtimes[i], paths[i]);
+        if (!version) continue;
+
+        length += snprintf(buf + length, sizeof(buf) - length, "%s%s %s",
+                           length ? ", " : "", runtimes[i].name, version);
+        if (length >= sizeof(buf)) length = sizeof(buf) - 1;
+        free(version);
+    }
+
+    return length ? strdup(buf) : NULL;
+}
+
+// Window managers and compositors recognised by their executable name
+struct wm_binary {
+    const char* exe;
+    const char* name;
+};
+
+static const struct wm_binary wm_binaries[] = {
+    { "kwin_wayland", "KWin" },
+    { "kwin_x11", "KWin" },
+    { "gnome-shell", "Mutter" },
+    { "mutter", "Mutter" },
+    { "sway", "Sway" },
+    { "Hyprland", "Hyprland" },
+    { "weston", "Weston" },
+    { "river", "River" },
+    { "labwc", "labwc" },
+    { "wayfire", "Wayfire" },
+    { "niri", "niri" },
+    { "cosmic-comp", "COSMIC" },
+    { "xfwm4", "Xfwm4" },
+    { "openbox", "Openbox" },
+    { "i3", "i3" },
+    { "bspwm", "bspwm" },
+    { "awesome", "awesome" },
+    { "marco", "Marco" },
+    { "muffin", "Muffin" },
+};
+
+// Function to get the executable name of a running process
+int get_process_name(pid_t pid, char* name, size_t size) {
+    char link[64];
+    char exe[PATH_MAX];
+    snprintf(link, sizeof(link), "/proc/%d/exe", (int)pid);
+    ssize_t length = io_readlink(link, exe, sizeof(exe) - 1);
+    if (length <= 0) return -1;
+    exe[length] = '\0';
+    exe[strcspn(exe, " ")] = '\0';
+
+    const char* base = strrchr(exe, '/');
+    snprintf(name, size, "%s", base ? base + 1 : exe);
+    return 0;
+}
+
+// Function to describe a running process as "<name> <version>" from its executable
+char* describe_process(pid_t pid, const char* name) {
+    char link[64];
+    char exe[PATH_MAX];
+    snprintf(link, sizeof(link), "/proc/%d/exe", (int)pid);
+    ssize_t length = io_readlink(link, exe, sizeof(exe) - 1);
+    if (length <= 0) return name ? strdup(name) : NULL;
+    exe[length] = '\0';
+
+    // An upgraded binary keeps running from the unlinked inode, the package database only knows its original path
+    // so that is what is looked up, giving the version now installed there
+    if (length > 10 && strcmp(exe + length - 10, " (deleted)") == 0) exe[length - 10] = '\0';
+
+    const char* base = strrchr(exe, '/');
+    base = base ? base + 1 : exe;
+    if (!name) {
+        name = base;
+        for (size_t i = 0; i < sizeof(wm_binaries) / sizeof(wm_binaries[0]); i++) {
+            if (strcmp(wm_binaries[i].exe, base) == 0) name = wm_binaries[i].name;
+        }
+    }
+
+    // Unpackaged builds usually log "<Name> version X.Y" at startup, the same string names their version
+    char marker[MAX_LINE_LENGTH];
+    snprintf(marker, sizeof(marker), "%s version ", name);
+    char* version = get_binary_version(exe, marker);
+    char* result;
+    if (version) {
+        size_t size = strlen(name) + strlen(version) + 2;
+        result = malloc(size);
+        if (!result) handle_error("Memory allocation failed");
+        snprintf(result, size, "%s %s", name, version);
+        free(version);
+    } else {
+        result = strdup(name);
+    }
+    return result;
+}
+
+// Function to connect to a unix socket and get the pid of the process serving it
+pid_t get_socket_peer_pid(const char* path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+
+    struct ucred cred;
+    socklen_t cred_length = sizeof(cred);
+    pid_t pid = -1;
+    if (io_connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+        getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_length) == 0) {
+        pid = cred.pid;
+    }
+
+    close(fd);
+    return pid;
+}
+
+// Function to describe the audio server answering on a socket, NULL if none is listening
+char* describe_audio_peer(const char* path, const char* name, int* is_pipewire) {
+    pid_t pid = get_socket_peer_pid(path);
+    if (pid <= 0) return NULL;
+
+    char exe_name[NAME_MAX + 1];
+    if (get_process_name(pid, exe_name, sizeof(exe_name)) == -1 || strcmp(exe_name, "systemd") == 0) {
+        // Socket activation: the server has not started yet, so there is no binary to ask
+        return strdup(name);
+    }
+
+    if (is_pipewire) *is_pipewire = strncmp(exe_name, "pipewire", 8) == 0;
+    return describe_process(pid, name);
+}
+
+// Function to detect the audio servers from their sockets in the runtime directory
+char* get_audio_server() {
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+    char path[PATH_MAX];
+    char* pipewire = NULL;
+    char* pulse = NULL;
+    int pulse_is_pipewire = 0;
+
+    if (runtime_dir) {
+        snprintf(path, sizeof(path), "%s/pipewire-0", runtime_dir);
+        pipewire = describe_audio_peer(path, "PipeWire", NULL);
+        snprintf(path, sizeof(path), "%s/pulse/native", runtime_dir);
+        pulse = describe_audio_peer(path, "PulseAudio", &pulse_is_pipewire);
+    }
+
+    // jackd keeps its request socket under /dev/shm unless JACK_TMPDIR moves it
+    snprintf(path, sizeof(path), "%s/jack_default_%d_0", get_env_or_default("JACK_TMPDIR", "/dev/shm"), (int)getuid());
+    char* jack = describe_audio_peer(path, "JACK", NULL);
+
+    // pipewire-pulse serving the PulseAudio socket is part of PipeWire, not a separate server
+    if (pulse && pulse_is_pipewire) {
+        free(pulse);
+        pulse = NULL;
+        if (!pipewire) pipewire = strdup("PipeWire");
+    }
+
+    char buf[MAX_LINE_LENGTH];
+    snprintf(buf, sizeof(buf), "%s%s%s%s%s%s",
+             pipewire ? pipewire : "", pipewire && pulse_is_pipewire ? " (PulseAudio)" : "",
+             pipewire && (pulse || jack) ? ", " : "",
+             pulse ? pulse : "", pulse && jack ? ", " : "",
+             jack ? jack : "");
+
+    free(pipewire);
+    free(pulse);
+    free(jack);
+    return buf[0] ? strdup(buf) : NULL;
+}
+
+// Function to find the compositor through the credentials of its Wayland socket
+pid_t get_wayland_compositor_pid() {
+    const char* display_name = get_env_or_default("WAYLAND_DISPLAY", "wayland-0");
+    char path[PATH_MAX];
+
+    if (display_name[0] == '/') {
+        snprintf(path, sizeof(path), "%s", display_name);
+    } else {
+        const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+        if (!runtime_dir) return -1;
+        snprintf(path, sizeof(path), "%s/%s", runtime_dir, display_name);
+    }
+
+    return get_socket_peer_pid(path);
+}
+
+// Function to read a window property, NULL if it is unset or of another type
+unsigned char* get_window_property(Display* display, Window window, Atom property, Atom type,
+                                   unsigned long* nitems) {
+    Atom actual_type;
+    int actual_format;
+    unsigned long bytes_after;
+    unsigned char* prop = NULL;
+
+    if (property == None || type == None) return NULL;
+    PROBE1(x11__roundtrip__start, "GetProperty");
+    int status = XGetWindowProperty(display, window, property, 0, 1024, False, type, &actual_type, &actual_format,
+                                    nitems, &bytes_after, &prop);
+    PROBE2(x11__roundtrip__end, "GetProperty", status);
+    if (status != Success) return NULL;
+    if (prop && (actual_type != type || *nitems == 0)) {
+        XFree(prop);
+        return NULL;
+    }
+    return prop;
+}
+
+enum {
+    ATOM_SUPPORTING_WM_CHECK,
+    ATOM_WM_NAME,
+    ATOM_WM_PID,
+    ATOM_UTF8_STRING,
+    ATOM_XKB_RULES_NAMES,
+    ATOM_COUNT
+};
+
+// Everything read from the X server, gathered over a single connection
+struct x11_info {
+    char* wm_name;
+    pid_t wm_pid;
+    char* xkb_names;
+    unsigned long xkb_names_length;
+};
+
+// Function to query the window manager and keyboard properties of the X server in one session
+void query_x11(struct x11_info* info) {
+    info->wm_name = NULL;
+    info->wm_pid = -1;
+    info->xkb_names = NULL;
+    info->xkb_names_length = 0;
+
+    PROBE1(x11__roundtrip__start, "OpenDisplay");
+    Display* display = io_open_display();
+    PROBE2(x11__roundtrip__end, "OpenDisplay", display != NULL);
+    if (!display) return;
+
+    // Intern every atom in a single round-trip
+    char* atom_names[ATOM_COUNT] = {
+        "_NET_SUPPORTING_WM_CHECK", "_NET_WM_NAME", "_NET_WM_PID", "UTF8_STRING", "_XKB_RULES_NAMES",
+    };
+    Atom atoms[ATOM_COUNT];
+    PROBE1(x11__roundtrip__start, "InternAtoms");
+    int interned = XInternAtoms(display, atom_names, ATOM_COUNT, True, atoms);
+    PROBE2(x11__roundtrip__end, "InternAtoms", interned);
+    if (!interned) {
+        for (int i = 0; i < ATOM_COUNT; i++) atoms[i] = None;
+    }
+
+    Window root = DefaultRootWindow(display);
+    Window check = root;
+    unsigned long nitems;
+    unsigned char* prop = get_window_property(display, root, atoms[ATOM_SUPPORTING_WM_CHECK], XA_WINDOW, &nitems);
+    if (prop) {
+        check = *(Window*)prop;
+        XFree(prop);
+    }
+
+    prop = get_window_property(display, check, atoms[ATOM_WM_NAME], atoms[ATOM_UTF8_STRING], &nitems);
+    if (!prop && check != root) {
+        prop = get_window_property(display, root, atoms[ATOM_WM_NAME], atoms[ATOM_UTF8_STRING], &nitems);
+    }
+    if (prop) {
+        info->wm_name = strndup((char*)prop, nitems);
+        XFree(prop);
+    }
+
+    // The pid only means something when the display is on this host
+    const char* display_string = DisplayString(display);
+    if (display_string[0] == ':' || strncmp(display_string, "unix:", 5) == 0) {
+        prop = get_window_property(display, check, atoms[ATOM_WM_PID], XA_CARDINAL, &nitems);
+        if (prop) {
+            info->wm_pid = (pid_t)*(unsigned long*)prop;
+            XFree(prop);
+        }
+    }
+
+    // NUL-separated rules, model, layouts, variants and options set by the XKB loader
+    prop = get_window_property(display, root, atoms[ATOM_XKB_RULES_NAMES], XA_STRING, &nitems);
+    if (prop) {
+        info->xkb_names = malloc(nitems + 1);
+        if (!info->xkb_names) handle_error("Memory allocation failed");
+        memcpy(info->xkb_names, prop, nitems);
+        info->xkb_names[nitems] = '\0';
+        info->xkb_names_length = nitems;
+        XFree(prop);
+    }
+
+    XCloseDisplay(display);
+}
+
+// Function to release what query_x11() collected
+void free_x11_info(struct x11_info* info) {
+    free(info->wm_name);
+    free(info->xkb_names);
+}
+
+// Function to identify the X11 window manager from its EWMH check window
+char* get_x11_window_manager(const struct x11_info* x11) {
+    if (x11->wm_pid > 0) return describe_process(x11->wm_pid, x11->wm_name);
+    return strdup(x11->wm_name ? x11->wm_name : "Unknown WM");
+}
+
+// Function to detect the window manager or compositor and its version
+char* get_window_manager(const struct x11_info* x11) {
+    const char* session_type = getenv("XDG_SESSION_TYPE");
+
+    if (session_type && strcmp(session_type, "wayland") == 0) {
+        pid_t pid = get_wayland_compositor_pid();
+        char* compositor = pid > 0 ? describe_process(pid, NULL) : NULL;
+        if (compositor) {
+            size_t size = strlen(compositor) + sizeof(" (Wayland)");
+            char* result = malloc(size);
+            if (!result) handle_error("Memory allocation failed");
+            snprintf(result, size, "%s (Wayland)", compositor);
+            free(compositor);
+            return result;
+        }
+
+        const char* desktop = getenv("XDG_CURRENT_DESKTOP");
+        const char* session = getenv("DESKTOP_SESSION");
+
+        if (desktop && strstr(desktop, "GNOME")) return strdup("Mutter (Wayland)");
+        if (desktop && strstr(desktop, "KDE") && session &&
+            (strstr(session, "plasma") || strstr(session, "kde"))) {
+            return strdup("KWin (Wayland)");
+        }
+
+        return strdup("Wayland Compositor");
+    }
+
+    if (session_type && strcmp(session_type, "x11") == 0) {
+        return get_x11_window_manager(x11);
+    }
+
+    return strdup("Unknown");
+}
+
+// Function to get the locale from the environment, falling back to the system configuration
+char* get_locale() {
+    const char* vars[] = { "LC_ALL", "LANG" };
+    for (size_t i = 0; i < sizeof(vars) / sizeof(vars[0]); i++) {
+        const char* value = getenv(vars[i]);
+        if (value && *value) return strdup(value);
+    }
+
+    const char* files[] = { "/etc/locale.conf", "/etc/default/locale" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        char buf[4096];
+        if (read_file(files[i], buf, sizeof(buf)) <= 0) continue;
+
+        for (char* line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")) {
+            if (strncmp(line, "LANG=", 5) != 0) continue;
+            char* quoted = extract_quoted_string(line);
+            if (quoted) return quoted;
+            return strdup(line + 5);
+        }
+    }
+
+    return NULL;
+}
+
+// Function to format the X11 layouts as "us, de (nodeadkeys)" from _XKB_RULES_NAMES
+char* format_xkb_names(const struct x11_info* x11) {
+    const char* names[5] = { NULL };
+    const char* p = x11->xkb_names;
+    const char* end = p + x11->xkb_names_length;
+    for (int i = 0; i < 5 && p < end; i++) {
+        names[i] = p;
+        p += strlen(p) + 1;
+    }
+    if (!names[2] || !*names[2]) return NULL;
+
+    char layouts[MAX_LINE_LENGTH];
+    char variants[MAX_LINE_LENGTH];
+    snprintf(layouts, sizeof(layouts), "%s", names[2]);
+    snprintf(variants, sizeof(variants), "%s", names[3] ? names[3] : "");
+
+    // strsep keeps empty fields, so variants stay aligned with their layouts
+    struct buffer out = { 0 };
+    char* layout_cursor = layouts;
+    char* variant_cursor = variants;
+    for (char* layout = strsep(&layout_cursor, ","); layout; layout = strsep(&layout_cursor, ",")) {
+        char* variant = variant_cursor ? strsep(&variant_cursor, ",") : NULL;
+        if (!*layout) continue;
+
+        buffer_printf(&out, out.length ? ", %s" : "%s", layout);
+        if (variant && *variant) buffer_printf(&out, " (%s)", variant);
+    }
+
+    return out.data;
+}
+
+// Function to extract the layout names from a compiled XKB keymap
+char* parse_keymap_layouts(const char* keymap, size_t size) {
+    struct buffer out = { 0 };
+    const char* end = keymap + size;
+
+    // The symbols section carries a readable name per group: name[Group1]="English (US)";
+    for (const char* p = memmem(keymap, size, "name[Group", 10); p; p = memmem(p + 1, end - p - 1, "name[Group", 10)) {
+        const char* open = memchr(p, '"', end - p);
+        const char* close = open ? memchr(open + 1, '"', end - open - 1) : NULL;
+        if (!close) break;
+        if (out.length) buffer_append(&out, ", ", 2);
+        buffer_append(&out, open + 1, close - open - 1);
+        p = close;
+    }
+
+    return out.data;
+}
+
+// State filled in by the Wayland seat and keyboard listeners
+struct wayland_keyboard {
+    struct wl_seat* seat;
+    struct wl_keyboard* keyboard;
+    char* layouts;
+};
+
+void keyboard_keymap(void* data, struct wl_keyboard* keyboard, uint32_t format, int32_t fd, uint32_t size) {
+    struct wayland_keyboard* state = data;
+    if (format == WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1 && !state->layouts) {
+        char* keymap = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (keymap != MAP_FAILED) {
+            state->layouts = parse_keymap_layouts(keymap, size);
+            munmap(keymap, size);
+        }
+    }
+    close(fd);
+}
+
+void keyboard_enter(void* data, struct wl_keyboard* keyboard, uint32_t serial, struct wl_surface* surface,
+                    struct wl_array* keys) {}
+void keyboard_leave(void* data, struct wl_keyboard* keyboard, uint32_t serial, struct wl_surface* surface) {}
+void keyboard_key(void* data, struct wl_keyboard* keyboard, uint32_t serial, uint32_t time, uint32_t key,
+                  uint32_t state) {}
+void keyboard_modifiers(void* data, struct wl_keyboard* keyboard, uint32_t serial, uint32_t depressed,
+                        uint32_t latched, uint32_t locked, uint32_t group) {}
+void keyboard_repeat_info(void* data, struct wl_keyboard* keyboard, int32_t rate, int32_t delay) {}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+    keyboard_keymap, keyboard_enter, keyboard_leave, keyboard_key, keyboard_modifiers, keyboard_repeat_info,
+};
+
+void seat_capabilities(void* data, struct wl_seat* seat, uint32_t capabilities) {
+    struct wayland_keyboard* state = data;
+    if ((capabilities & WL_SEAT_CAPABILITY_KEYBOARD) && !state->keyboard) {
+        state->keyboard = wl_seat_get_keyboard(seat);
+        wl_keyboard_add_listener(state->keyboard, &keyboard_listener, state);
+    }
+}
+
+void seat_name(void* data, struct wl_seat* seat, const char* name) {}
+
+static const struct wl_seat_listener seat_listener = { seat_capabilities, seat_name };
+
+void registry_global(void* data, struct wl_registry* registry, uint32_t name, const char* interface,
+                     uint32_t version) {
+    struct wayland_keyboard* state = data;
+    if (strcmp(interface, "wl_seat") == 0 && !state->seat) {
+        state->seat = wl_registry_bind(registry, name, &wl_seat_interface, 1);
+        wl_seat_add_listener(state->seat, &seat_listener, state);
+    }
+}
+
+void registry_global_remove(void* data, struct wl_registry* registry, uint32_t name) {}
+
+static const struct wl_registry_listener registry_listener = { registry_global, registry_global_remove };
+
+// Function to read the layouts from the keymap the compositor hands to every keyboard
+char* get_wayland_keyboard_layout() {
+    struct wl_display* display = io_connect_wayland();
+    if (!display) return NULL;
+
+    struct wayland_keyboard state = { NULL, NULL, NULL };
+    struct wl_registry* registry = wl_display_get_registry(display);
+    wl_registry_add_listener(registry, &registry_listener, &state);
+
+    // Globals, then seat capabilities, then the keymap sent on keyboard creation
+    for (int i = 0; i < 3 && !state.layouts; i++) {
+        PROBE1(wayland__roundtrip__start, i);
+        int dispatched = wl_display_roundtrip(display);
+        PROBE2(wayland__roundtrip__end, i, dispatched);
+        if (dispatched == -1) break;
+    }
+
+    if (state.keyboard) wl_keyboard_destroy(state.keyboard);
+    if (state.seat) wl_seat_destroy(state.seat);
+    wl_registry_destroy(registry);
+    wl_display_disconnect(display);
+    return state.layouts;
+}
+
+// Function to get the active keyboard layouts of the session
+char* get_keyboard_layout(const struct x11_info* x11) {
+    const char* session_type = getenv("XDG_SESSION_TYPE");
+    if (session_type && strcmp(session_type, "wayland") == 0) return get_wayland_keyboard_layout();
+    if (x11->xkb_names) return format_xkb_names(x11);
+    return NULL;
+}
+
+// A labelled value of the report, value is NULL when nothing was found
+struct field {
+    const char* label;
+    const char* key;
+    char* value;
+};
+
+// All fields collected in one pass, in display order
+struct report {
+    struct field fields[MAX_FIELDS];
+    size_t count;
+};
+
+// Function to add a field to the report, taking ownership of the value
+void report_add(struct report* report, const char* label, const char* key, char* value) {
+    if (report->count == MAX_FIELDS) {
+        free(value);
+        return;
+    }
+    report->fields[report->count++] = (struct field){ label, key, value };
+}
+
+// Function to release the values held by a report
+void report_free(struct report* report) {
+    for (size_t i = 0; i < report->count; i++) free(report->fields[i].value);
+    report->count = 0;
+}
+
+// Header of the system snapshot, followed by an offset table and a string area
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+};
+
+// One snapshot entry, offsets point into the file and 0 marks an unknown value
+struct snapshot_entry {
+    uint32_t key;
+    uint32_t value;
+};
+
+// A mapped system snapshot, data is NULL when there is none
+struct snapshot {
+    char* data;
+    size_t size;
+};
+
+// Fields that are the same for every user of the host, published once by root
+static const char* const system_keys[] = { "os", "host", "kernel", "packages", "cpu", "gpu", "ram", "storage" };
+
+#define SYSTEM_KEY_COUNT (sizeof(system_keys) / sizeof(system_keys[0]))
+
+// Function to map the published system snapshot, leaving it empty if it is missing or invalid
+void load_snapshot(struct snapshot* snapshot) {
+    snapshot->data = map_file(SNAPSHOT_PATH, &snapshot->size);
+    if (!snapshot->data) return;
+
+    const struct snapshot_header* header = (const struct snapshot_header*)snapshot->data;
+    int valid = snapshot->size >= sizeof(*header) && memcmp(header->magic, SNAPSHOT_MAGIC, 8) == 0 &&
+                header->version == SNAPSHOT_VERSION &&
+                header->count <= (snapshot->size - sizeof(*header)) / sizeof(struct snapshot_entry) &&
+                snapshot->data[snapshot->size - 1] == '\0';
+    if (!valid) {
+        munmap(snapshot->data, snapshot->size);
+        snapshot->data = NULL;
+    }
+}
+
+// Function to release a mapped snapshot
+void unload_snapshot(struct snapshot* snapshot) {
+    if (snapshot->data) munmap(snapshot->data, snapshot->size);
+    snapshot->data = NULL;
+}
+
+// Function to take a value from the snapshot, returns 0 when the snapshot does not have the key
+int snapshot_get(const struct snapshot* snapshot, const char* key, char** value) {
+    if (!snapshot->data) return 0;
+
+    const struct snapshot_header* header = (const struct snapshot_header*)snapshot->data;
+    const struct snapshot_entry* entries = (const struct snapshot_entry*)(header + 1);
+    for (uint32_t i = 0; i < header->count; i++) {
+        if (entries[i].key >= snapshot->size || strcmp(snapshot->data + entries[i].key, key) != 0) continue;
+
+        *value = NULL;
+        if (entries[i].value && entries[i].value < snapshot->size) {
+            *value = strdup(snapshot->data + entries[i].value);
+            if (!*value) handle_error("Memory allocation failed");
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Function to collect one system-wide field, unless the snapshot already has it
+char* collect_system_field(const struct snapshot* snapshot, const char* key, const struct utsname* sys_info) {
+    char* value;
+    if (snapshot && snapshot_get(snapshot, key, &value)) return value;
+
+    if (strcmp(key, "os") == 0) {
+        value = get_os_name();
+        return value ? value : strdup("Unknown");
+    }
+    if (strcmp(key, "host") == 0) return get_host_model();
+    if (strcmp(key, "kernel") == 0) return get_kernel_info(sys_info);
+    if (strcmp(key, "packages") == 0) return get_package_counts();
+    if (strcmp(key, "cpu") == 0) return get_cpu_info();
+    if (strcmp(key, "gpu") == 0) return get_gpu_info();
+    if (strcmp(key, "ram") == 0) return get_memory_modules();
+    if (strcmp(key, "storage") == 0) return get_storage_info();
+    return NULL;
+}
+
+// Function to write the system snapshot: immutable, versioned and replaced atomically
+int run_publish_system() {
+    struct utsname sys_info = get_system_info();
+    struct buffer strings = { 0 };
+    struct snapshot_entry entries[SYSTEM_KEY_COUNT];
+    size_t table_size = sizeof(struct snapshot_header) + sizeof(entries);
+
+    for (size_t i = 0; i < SYSTEM_KEY_COUNT; i++) {
+        char* value = collect_system_field(NULL, system_keys[i], &sys_info);
+        entries[i].key = table_size + strings.length;
+        buffer_append(&strings, system_keys[i], strlen(system_keys[i]) + 1);
+        entries[i].value = value ? table_size + strings.length : 0;
+        if (value) buffer_append(&strings, value, strlen(value) + 1);
+        free(value);
+    }
+
+    struct snapshot_header header = { .version = SNAPSHOT_VERSION, .count = SYSTEM_KEY_COUNT };
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+
+    if (mkdir(SNAPSHOT_DIR, 0755) == -1 && errno != EEXIST) handle_error("Error creating " SNAPSHOT_DIR);
+
+    char tmp_path[] = SNAPSHOT_DIR "/.system.snap.XXXXXX";
+    int fd = mkstemp(tmp_path);
+    if (fd == -1) handle_error("Error creating snapshot");
+
+    int written = write_all(fd, (const char*)&header, sizeof(header)) == 0 &&
+                  write_all(fd, (const char*)entries, sizeof(entries)) == 0 &&
+                  write_all(fd, strings.data, strings.length) == 0 && fchmod(fd, 0444) == 0 && fsync(fd) == 0;
+    free(strings.data);
+
+    if (close(fd) != 0 || !written || rename(tmp_path, SNAPSHOT_PATH) == -1) {
+        unlink(tmp_path);
+        handle_error("Error writing snapshot");
+    }
+    return EXIT_SUCCESS;
+}
+
+// Function to run every collector and gather the results into a report
+void collect_report(struct report* report) {
+    struct utsname sys_info = get_system_info();
+    struct sysinfo sys_runtime_info = get_system_runtime_info();
+
+    // System-wide fields come from the root-published snapshot when there is one
+    struct snapshot snapshot;
+    load_snapshot(&snapshot);
+
+    struct x11_info x11 = { .wm_pid = -1 };
+    const char* session_type = getenv("XDG_SESSION_TYPE");
+    if (session_type && strcmp(session_type, "x11") == 0) query_x11(&x11);
+
+    // Every collector is bracketed by probes carrying its key, the end probe also carries the value
+#define COLLECT(label, key, collector)                \
+    do {                                              \
+        PROBE1(collector__start, key);                \
+        char* collected = collector;                  \
+        PROBE2(collector__end, key, collected);       \
+        report_add(report, label, key, collected);    \
+    } while (0)
+
+    report->count = 0;
+    COLLECT("Hostname", "hostname", strdup(sys_info.nodename));
+    COLLECT("FQDN", "fqdn", get_fqdn(sys_info.nodename));
+    COLLECT("Operating System", "os", collect_system_field(&snapshot, "os", &sys_info));
+    COLLECT("Host", "host", collect_system_field(&snapshot, "host", &sys_info));
+    COLLECT("Kernel", "kernel", collect_system_field(&snapshot, "kernel", &sys_info));
+    COLLECT("Reboot", "reboot", get_reboot_status(&sys_info));
+    COLLECT("Packages", "packages", collect_system_field(&snapshot, "packages", &sys_info));
+    COLLECT("Last Update", "last_update", get_last_update());
+    COLLECT("Failed Units", "failed_units", get_failed_units());
+    COLLECT("CPU", "cpu", collect_system_field(&snapshot, "cpu", &sys_info));
+    COLLECT("GPU", "gpu", collect_system_field(&snapshot, "gpu", &sys_info));
+    COLLECT("GPU Load", "gpu_load", get_gpu_load());
+    COLLECT("RAM", "ram", collect_system_field(&snapshot, "ram", &sys_info));
+    COLLECT("Storage", "storage", collect_system_field(&snapshot, "storage", &sys_info));
+    COLLECT("Session Type", "session_type", get_session_type());
+    COLLECT("Desktop Environment", "desktop", get_desktop_environment());
+    COLLECT("Window Manager/Compositor", "wm", get_window_manager(&x11));
+    COLLECT("Audio", "audio", get_audio_server());
+    COLLECT("Uptime", "uptime", get_uptime(&sys_runtime_info));
+    COLLECT("Last Login", "last_login", get_last_login());
+    COLLECT("Swap", "swap", get_swap_info(&sys_runtime_info));
+    COLLECT("Locale", "locale", get_locale());
+    COLLECT("Keyboard", "keyboard", get_keyboard_layout(&x11));
+    COLLECT("Runtimes", "runtimes", get_runtimes());
+#undef COLLECT
+
+    free_x11_info(&x11);
+    unload_snapshot(&snapshot);
+}
+
+// Function to find how many leading bytes are ASCII, sixteen at a time where SSE2 is available
+size_t ascii_prefix_length(const char* str, size_t length) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= length; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(str + i)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, str + i, sizeof(word));
+        if (word & 0x8080808080808080ULL) break;
+    }
+    while (i < length && !(str[i] & 0x80)) i++;
+    return i;
+}
+
+// Code point ranges that do not occupy one terminal column, sorted for binary search
+static const struct {
+    uint32_t first;
+    uint32_t last;
+    uint8_t width;
+} wide_ranges[] = {
+    { 0x0300, 0x036F, 0 },   { 0x0483, 0x0489, 0 },   { 0x0591, 0x05BD, 0 },   { 0x0610, 0x061A, 0 },
+    { 0x064B, 0x065F, 0 },   { 0x0670, 0x0670, 0 },   { 0x06D6, 0x06DC, 0 },   { 0x0900, 0x0902, 0 },
+    { 0x093A, 0x093C, 0 },   { 0x0941, 0x0948, 0 },   { 0x094D, 0x094D, 0 },   { 0x0E31, 0x0E31, 0 },
+    { 0x0E34, 0x0E3A, 0 },   { 0x0E47, 0x0E4E, 0 },   { 0x1100, 0x115F, 2 },   { 0x1AB0, 0x1AFF, 0 },
+    { 0x1DC0, 0x1DFF, 0 },   { 0x200B, 0x200F, 0 },   { 0x202A, 0x202E, 0 },   { 0x2060, 0x2064, 0 },
+    { 0x20D0, 0x20FF, 0 },   { 0x231A, 0x231B, 2 },   { 0x2329, 0x232A, 2 },   { 0x23E9, 0x23EC, 2 },
+    { 0x25FD, 0x25FE, 2 },   { 0x2614, 0x2615, 2 },   { 0x2648, 0x2653, 2 },   { 0x26A1, 0x26A1, 2 },
+    { 0x26BD, 0x26BE, 2 },   { 0x26C4, 0x26C5, 2 },   { 0x26D4, 0x26D4, 2 },   { 0x26EA, 0x26EA, 2 },
+    { 0x26F2, 0x26F5, 2 },   { 0x26FA, 0x26FD, 2 },   { 0x2705, 0x2705, 2 },   { 0x270A, 0x270B, 2 },
+    { 0x2728, 0x2728, 2 },   { 0x274C, 0x274C, 2 },   { 0x2753, 0x2757, 2 },   { 0x2795, 0x2797, 2 },
+    { 0x27B0, 0x27B0, 2 },   { 0x27BF, 0x27BF, 2 },   { 0x2B1B, 0x2B1C, 2 },   { 0x2B50, 0x2B55, 2 },
+    { 0x2E80, 0x303E, 2 },   { 0x3041, 0x33FF, 2 },   { 0x3400, 0x4DBF, 2 },   { 0x4E00, 0x9FFF, 2 },
+    { 0xA000, 0xA4CF, 2 },   { 0xA960, 0xA97F, 2 },   { 0xAC00, 0xD7A3, 2 },   { 0xF900, 0xFAFF, 2 },
+    { 0xFE00, 0xFE0F, 0 },   { 0xFE10, 0xFE19, 2 },   { 0xFE20, 0xFE2F, 0 },   { 0xFE30, 0xFE6F, 2 },
+    { 0xFEFF, 0xFEFF, 0 },   { 0xFF00, 0xFF60, 2 },   { 0xFFE0, 0xFFE6, 2 },   { 0x16FE0, 0x16FE4, 2 },
+    { 0x17000, 0x18CFF, 2 }, { 0x1B000, 0x1B2FF, 2 }, { 0x1F004, 0x1F004, 2 }, { 0x1F0CF, 0x1F0CF, 2 },
+    { 0x1F18E, 0x1F18E, 2 }, { 0x1F191, 0x1F19A, 2 }, { 0x1F200, 0x1F251, 2 }, { 0x1F300, 0x1F64F, 2 },
+    { 0x1F680, 0x1F6FF, 2 }, { 0x1F7E0, 0x1F7EB, 2 }, { 0x1F90C, 0x1F9FF, 2 }, { 0x1FA70, 0x1FAFF, 2 },
+    { 0x20000, 0x2FFFD, 2 }, { 0x30000, 0x3FFFD, 2 }, { 0xE0001, 0xE01EF, 0 },
+};
+
+// A pure function to look up the terminal column width of a non-ASCII code point
+int codepoint_width(uint32_t codepoint) {
+    size_t low = 0;
+    size_t high = sizeof(wide_ranges) / sizeof(wide_ranges[0]);
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (codepoint < wide_ranges[mid].first) {
+            high = mid;
+        } else if (codepoint > wide_ranges[mid].last) {
+            low = mid + 1;
+        } else {
+            return wide_ranges[mid].width;
+        }
+    }
+    return codepoint < 0xA0 ? 0 : 1;
+}
+
+// A pure function to decode one UTF-8 sequence, invalid bytes decode as themselves
+size_t decode_utf8(const unsigned char* str, size_t length, uint32_t* codepoint) {
+    unsigned char lead = str[0];
+    size_t count = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+    if (count == 1 || count > length) {
+        *codepoint = lead;
+        return 1;
+    }
+
+    uint32_t value = lead & (0x7F >> count);
+    for (size_t i = 1; i < count; i++) {
+        if ((str[i] & 0xC0) != 0x80) {
+            *codepoint = lead;
+            return 1;
+        }
+        value = value << 6 | (str[i] & 0x3F);
+    }
+    *codepoint = value;
+    return count;
+}
+
+// A pure function to measure a string in terminal columns, stopping before max_width is exceeded
+size_t clip_to_width(const char* str, size_t length, size_t max_width, size_t* width) {
+    // ASCII text is one column per byte, so the common case is a single scan
+    size_t ascii = ascii_prefix_length(str, length);
+    if (ascii >= length || ascii >= max_width) {
+        size_t bytes = length < max_width ? length : max_width;
+        *width = bytes;
+        return bytes;
+    }
+
+    size_t columns = ascii;
+    size_t i = ascii;
+    while (i < length) {
+        uint32_t codepoint;
+        size_t count = decode_utf8((const unsigned char*)str + i, length - i, &codepoint);
+        int columns_needed = codepoint < 0x80 ? 1 : codepoint_width(codepoint);
+        if (columns + columns_needed > max_width) break;
+        columns += columns_needed;
+        i += count;
+    }
+
+    *width = columns;
+    return i;
+}
+
+// A pure function to measure a string in terminal columns
+size_t display_width(const char* str) {
+    size_t width;
+    clip_to_width(str, strlen(str), SIZE_MAX, &width);
+    return width;
+}
+
+// Color support of the output, decides which escape sequences are emitted
+enum color_depth { COLOR_NONE, COLOR_16, COLOR_256, COLOR_TRUE };
+
+// Output formats selected with --format
+enum output_format { FORMAT_TEXT, FORMAT_JSON, FORMAT_NDJSON, FORMAT_SH };
+
+// Everything besides the field values that shapes the rendered output
+struct render_options {
+    enum output_format format;
+    size_t width;
+    enum color_depth colors;
+    int logo;
+};
+
+static const char* const logo[] = {
+    "    .--.",
+    "   |o_o |",
+    "   |:_/ |",
+    "  //   \\ \\",
+    " (|     | )",
+    "/'\\_   _/`\\",
+    "\\___)=(___/",
+};
+
+#define LOGO_LINES (sizeof(logo) / sizeof(logo[0]))
+
+// Function to detect how many colors the terminal on stdout understands
+enum color_depth detect_color_depth() {
+    const char* no_color = getenv("NO_COLOR");
+    if ((no_color && *no_color) || !isatty(STDOUT_FILENO)) return COLOR_NONE;
+
+    const char* term = get_env_or_default("TERM", "");
+    if (strcmp(term, "dumb") == 0) return COLOR_NONE;
+
+    const char* colorterm = get_env_or_default("COLORTERM", "");
+    if (strcmp(colorterm, "truecolor") == 0 || strcmp(colorterm, "24bit") == 0) return COLOR_TRUE;
+    if (strstr(term, "256color")) return COLOR_256;
+    return COLOR_16;
+}
+
+// Function to get the width of the terminal on stdout, 0 when it is not a terminal
+size_t get_terminal_width() {
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) return size.ws_col;
+    return 0;
+}
+
+// Function to render the report as "Label: value" lines, next to the logo when enabled
+void render_text(const struct report* report, const struct render_options* options, struct buffer* out) {
+    static const char* const label_colors[] = { "", "\033[1;34m", "\033[1;38;5;33m", "\033[1;38;2;80;160;255m" };
+    static const char* const logo_colors[] = { "", "\033[33m", "\033[38;5;214m", "\033[38;2;255;175;0m" };
+    const char* reset = options->colors ? "\033[0m" : "";
+
+    // The logo column is as wide as its widest line, measured once
+    size_t logo_width = 0;
+    if (options->logo) {
+        for (size_t i = 0; i < LOGO_LINES; i++) {
+            size_t width = display_width(logo[i]);
+            if (width > logo_width) logo_width = width;
+        }
+        logo_width += LOGO_GAP;
+    }
+
+    const struct field* fields[MAX_FIELDS];
+    size_t field_count = 0;
+    for (size_t i = 0; i < report->count; i++) {
+        if (report->fields[i].value) fields[field_count++] = &report->fields[i];
+    }
+
+    // Every part of a row is clipped against the same budget so a narrow terminal never wraps
+    size_t rows = options->logo && LOGO_LINES > field_count ? LOGO_LINES : field_count;
+    for (size_t row = 0; row < rows; row++) {
+        size_t room = options->width ? options->width : SIZE_MAX;
+        size_t width;
+        if (options->logo) {
+            const char* line = row < LOGO_LINES ? logo[row] : "";
+            size_t length = clip_to_width(line, strlen(line), room, &width);
+            if (length) buffer_printf(out, "%s%.*s%s", logo_colors[options->colors], (int)length, line, reset);
+            room -= width;
+            if (row < field_count) {
+                for (; width < logo_width && room > 0; width++, room--) buffer_append(out, " ", 1);
+            }
+        }
+
+        if (row < field_count) {
+            const struct field* field = fields[row];
+            size_t length = clip_to_width(field->label, strlen(field->label), room, &width);
+            if (length) buffer_printf(out, "%s%.*s%s", label_colors[options->colors], (int)length, field->label, reset);
+            room -= width;
+            length = clip_to_width(": ", 2, room, &width);
+            buffer_append(out, ": ", length);
+            room -= width;
+            buffer_append(out, field->value, clip_to_width(field->value, strlen(field->value), room, &width));
+        }
+
+        buffer_append(out, "\n", 1);
+    }
+}
+
+// Function to render the report as a single-line JSON object
+void render_json(const struct report* report, struct buffer* out) {
+    buffer_append(out, "{", 1);
+    for (size_t i = 0; i < report->count; i++) {
+        buffer_printf(out, "%s\"%s\":", i ? "," : "", report->fields[i].key);
+        buffer_append_json(out, report->fields[i].value);
+    }
+    buffer_append(out, "}\n", 2);
+}
+
+// Function to render the known fields as shell assignments, safe to eval
+void render_sh(const struct report* report, struct buffer* out) {
+    for (size_t i = 0; i < report->count; i++) {
+        const struct field* field = &report->fields[i];
+        if (!field->value) continue;
+
+        buffer_append(out, "XFETCH_", 7);
+        for (const char* c = field->key; *c; c++) {
+            char upper = toupper((unsigned char)*c);
+            buffer_append(out, &upper, 1);
+        }
+
+        // Single quotes keep everything literal, embedded ones are closed and escaped
+        buffer_append(out, "='", 2);
+        for (const char* c = field->value; *c; c++) {
+            if (*c == '\'') {
+                buffer_append(out, "'\\''", 4);
+            } else {
+                buffer_append(out, c, 1);
+            }
+        }
+        buffer_append(out, "'\n", 2);
+    }
+}
+
+// A pure function to compare two possibly unknown values
+int values_equal(const char* a, const char* b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+// Function to render the fields that differ from the last emitted report as one NDJSON record
+int render_ndjson_delta(const struct report* report, struct report* emitted, unsigned long long seq,
+                        struct buffer* out) {
+    int changed = 0;
+    buffer_printf(out, "{\"seq\":%llu", seq);
+
+    for (size_t i = 0; i < report->count; i++) {
+        const struct field* field = &report->fields[i];
+        struct field* last = i < emitted->count ? &emitted->fields[i] : NULL;
+        if (last && values_equal(last->value, field->value)) continue;
+
+        buffer_printf(out, ",\"%s\":", field->key);
+        buffer_append_json(out, field->value);
+        changed = 1;
+
+        if (last) {
+            free(last->value);
+            last->value = field->value ? strdup(field->value) : NULL;
+        } else {
+            report_add(emitted, field->label, field->key, field->value ? strdup(field->value) : NULL);
+        }
+    }
+
+    buffer_append(out, "}\n", 2);
+    return changed;
+}
+
+// Function to render a complete report in the requested format
+void render_report(const struct report* report, const struct render_options* options, struct buffer* out) {
+    if (options->format == FORMAT_TEXT) {
+        render_text(report, options, out);
+    } else if (options->format == FORMAT_JSON) {
+        render_json(report, out);
+    } else if (options->format == FORMAT_SH) {
+        render_sh(report, out);
+    } else {
+        struct report emitted = { .count = 0 };
+        render_ndjson_delta(report, &emitted, 1, out);
+        report_free(&emitted);
+    }
+}
+
+static volatile sig_atomic_t watch_stopped = 0;
+
+void handle_watch_stop(int signum) {
+    watch_stopped = 1;
+}
+
+// Function to re-collect every interval and stream the report to stdout
+int run_watch(const struct render_options* options, long interval_ms) {
+    enable_gpu_monitors();
+    struct report emitted = { .count = 0 };
+    struct buffer out = { 0 };
+    size_t written = 0;
+    unsigned long long seq = 0;
+
+    // A slow pipe must not stall collection, pending changes are coalesced instead
+    // The file description is shared with the parent, so its flags are put back before returning
+    struct stat st;
+    int stdout_flags = fcntl(STDOUT_FILENO, F_GETFL);
+    if (stdout_flags != -1 && fstat(STDOUT_FILENO, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))) {
+        fcntl(STDOUT_FILENO, F_SETFL, stdout_flags | O_NONBLOCK);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction action = { 0 };
+    action.sa_handler = handle_watch_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+
+    int error = 0;
+    long long next_tick = monotonic_ms();
+    while (!error && !watch_stopped) {
+        long long now = monotonic_ms();
+        if (now >= next_tick) {
+            next_tick = now + interval_ms;
+
+            // While a record is still draining the diff keeps growing against what was emitted
+            if (written == out.length) {
+                struct report report;
+                collect_report(&report);
+                out.length = 0;
+                written = 0;
+
+                if (options->format == FORMAT_NDJSON) {
+                    if (!render_ndjson_delta(&report, &emitted, seq + 1, &out)) {
+                        out.length = 0;
+                    } else {
+                        seq++;
+                    }
+                } else {
+                    render_report(&report, options, &out);
+                    if (options->format == FORMAT_TEXT) buffer_append(&out, "\n", 1);
+                }
+                report_free(&report);
+            }
+        }
+
+        if (written < out.length) {
+            ssize_t n = write(STDOUT_FILENO, out.data + written, out.length - written);
+            if (n > 0) {
+                written += n;
+            } else if (n == -1 && errno != EAGAIN && errno != EINTR) {
+                error = errno;
+            }
+        }
+
+        struct pollfd pfd = { .fd = STDOUT_FILENO, .events = POLLOUT };
+        long long timeout = next_tick - monotonic_ms();
+        if (timeout < 0) timeout = 0;
+        poll(&pfd, written < out.length ? 1 : 0, (int)timeout);
+    }
+
+    if (stdout_flags != -1) fcntl(STDOUT_FILENO, F_SETFL, stdout_flags);
+    report_free(&emitted);
+    free(out.data);
+    return error == EPIPE || watch_stopped ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// One terminal cell of the live view, a wide character leaves an empty continuation cell after it
+struct cell {
+    char text[MAX_CELL_BYTES];
+    uint8_t length;
+    uint8_t attr;
+};
+
+// Cell attributes of the live view
+enum { ATTR_PLAIN, ATTR_LABEL, ATTR_LOGO, ATTR_TITLE };
+
+// Double-buffered screen model: front is what the terminal shows, back is the next frame
+struct screen {
+    int rows;
+    int cols;
+    struct cell* front;
+    struct cell* back;
+};
+
+static volatile sig_atomic_t live_resized = 1;
+static volatile sig_atomic_t live_stopped = 0;
+
+void handle_live_resize(int signum) {
+    live_resized = 1;
+}
+
+void handle_live_stop(int signum) {
+    live_stopped = 1;
+}
+
+// Function to size the screen to the terminal, the caller clears it so the front buffer starts blank
+void resize_screen(struct screen* screen) {
+    struct winsize size;
+    screen->rows = 24;
+    screen->cols = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0) {
+        screen->rows = size.ws_row;
+        screen->cols = size.ws_col;
+    }
+
+    size_t cells = (size_t)screen->rows * screen->cols;
+    screen->front = realloc(screen->front, cells * sizeof(struct cell));
+    screen->back = realloc(screen->back, cells * sizeof(struct cell));
+    if (!screen->front || !screen->back) handle_error("Memory allocation failed");
+
+    for (size_t i = 0; i < cells; i++) screen->front[i] = (struct cell){ .text = " ", .length = 1, .attr = ATTR_PLAIN };
+}
+
+// Function to draw a string into the back buffer, returns the column after it
+int draw_text(struct screen* screen, int row, int col, const char* text, uint8_t attr) {
+    if (row >= screen->rows) return col;
+
+    struct cell* line = screen->back + (size_t)row * screen->cols;
+    const unsigned char* p = (const unsigned char*)text;
+    size_t remaining = strlen(text);
+
+    while (remaining > 0) {
+        uint32_t codepoint;
+        size_t count = decode_utf8(p, remaining, &codepoint);
+        int width = codepoint < 0x80 ? (codepoint >= 0x20) : codepoint_width(codepoint);
+
+        if (width == 0) {
+            // Combining marks join the cell before them
+            struct cell* previous = col > 0 ? &line[col - 1] : NULL;
+            while (previous && previous->length == 0 && previous > line) previous--;
+            if (previous && previous->length + count <= MAX_CELL_BYTES) {
+                memcpy(previous->text + previous->length, p, count);
+                previous->length += count;
+            }
+        } else {
+            if (col + width > screen->cols) break;
+            struct cell* cell = &line[col];
+            memcpy(cell->text, p, count);
+            cell->length = count;
+            cell->attr = attr;
+            if (width == 2) line[col + 1] = (struct cell){ .length = 0, .attr = attr };
+            col += width;
+        }
+
+        p += count;
+        remaining -= count;
+    }
+
+    return col;
+}
+
+// Function to lay the report out into the back buffer, same arrangement as the text output
+void layout_screen(struct screen* screen, const struct report* report, const struct render_options* options) {
+    size_t cells = (size_t)screen->rows * screen->cols;
+    for (size_t i = 0; i < cells; i++) screen->back[i] = (struct cell){ .text = " ", .length = 1, .attr = ATTR_PLAIN };
+
+    char title[MAX_LINE_LENGTH];
+    char clock[16];
+    time_t now = time(NULL);
+    strftime(clock, sizeof(clock), "%H:%M:%S", localtime(&now));
+    snprintf(title, sizeof(title), "xfetch live  %s  (Ctrl-C to quit)", clock);
+    draw_text(screen, 0, 0, title, ATTR_TITLE);
+
+    int logo_width = 0;
+    if (options->logo) {
+        for (size_t i = 0; i < LOGO_LINES; i++) {
+            int width = display_width(logo[i]);
+            if (width > logo_width) logo_width = width;
+            draw_text(screen, 2 + i, 0, logo[i], ATTR_LOGO);
+        }
+        logo_width += LOGO_GAP;
+    }
+
+    int row = 2;
+    for (size_t i = 0; i < report->count; i++) {
+        const struct field* field = &report->fields[i];
+        if (!field->value) continue;
+
+        int col = draw_text(screen, row, logo_width, field->label, ATTR_LABEL);
+        col = draw_text(screen, row, col, ": ", ATTR_PLAIN);
+        draw_text(screen, row, col, field->value, ATTR_PLAIN);
+        row++;
+    }
+}
+
+// A pure function to compare two cells
+int cells_equal(const struct cell* a, const struct cell* b) {
+    return a->length == b->length && a->attr == b->attr && memcmp(a->text, b->text, a->length) == 0;
+}
+
+// Function to emit only the cells that changed since the last frame, then flip the buffers
+void diff_screen(struct screen* screen, const struct render_options* options, struct buffer* out) {
+    static const char* const attr_colors[][4] = {
+        [ATTR_PLAIN] = { "", "", "", "" },
+        [ATTR_LABEL] = { "", "\033[1;34m", "\033[1;38;5;33m", "\033[1;38;2;80;160;255m" },
+        [ATTR_LOGO] = { "", "\033[33m", "\033[38;5;214m", "\033[38;2;255;175;0m" },
+        [ATTR_TITLE] = { "", "\033[7m", "\033[7m", "\033[7m" },
+    };
+
+    int cursor_row = -1;
+    int cursor_col = -1;
+    int current_attr = -1;
+
+    for (int row = 0; row < screen->rows; row++) {
+        for (int col = 0; col < screen->cols; col++) {
+            size_t index = (size_t)row * screen->cols + col;
+            if (cells_equal(&screen->back[index], &screen->front[index])) continue;
+            if (screen->back[index].length == 0) continue; // Covered by the wide character before it
+
+            // Reprinting a short unchanged gap is cheaper than a cursor movement sequence
+            int from = col;
+            if (row == cursor_row && col > cursor_col && col - cursor_col <= 6) {
+                from = cursor_col;
+            } else if (row != cursor_row || col != cursor_col) {
+                buffer_printf(out, "\033[%d;%dH", row + 1, col + 1);
+            }
+
+            for (int c = from; c <= col; c++) {
+                struct cell* cell = &screen->back[(size_t)row * screen->cols + c];
+                if (cell->length == 0) continue;
+                if (cell->attr != current_attr) {
+                    buffer_printf(out, "\033[0m%s", attr_colors[cell->attr][options->colors]);
+                    current_attr = cell->attr;
+                }
+                buffer_append(out, cell->text, cell->length);
+            }
+
+            cursor_row = row;
+            cursor_col = col + 1;
+            if (col + 1 < screen->cols && screen->back[index + 1].length == 0) cursor_col++;
+        }
+    }
+
+    if (current_attr != -1) buffer_append(out, "\033[0m", 4);
+
+    struct cell* front = screen->front;
+    screen->front = screen->back;
+    screen->back = front;
+}
+
+// Function to run the full-screen dashboard, redrawing only what changes every interval
+int run_live(const struct render_options* options, long interval_ms) {
+    if (!isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "xfetch: --live needs a terminal on stdout\n");
+        return EXIT_FAILURE;
+    }
+    enable_gpu_monitors();
+
+    struct sigaction action = { 0 };
+    action.sa_handler = handle_live_resize;
+    sigaction(SIGWINCH, &action, NULL);
+    action.sa_handler = handle_live_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // Alternate screen, hidden cursor
+    const char enter[] = "\033[?1049h\033[?25l";
+    write_all(STDOUT_FILENO, enter, sizeof(enter) - 1);
+
+    struct screen screen = { 0 };
+    struct buffer frame = { 0 };
+    struct report report = { .count = 0 };
+    long long next_collect = 0;
+
+    while (!live_stopped) {
+        frame.length = 0;
+
+        // Any number of SIGWINCH since the last frame is one relayout
+        if (live_resized) {
+            live_resized = 0;
+            resize_screen(&screen);
+            buffer_append(&frame, "\033[2J", 4);
+        }
+
+        long long now = monotonic_ms();
+        if (now >= next_collect) {
+            report_free(&report);
+            collect_report(&report);
+            next_collect = now + interval_ms;
+        }
+
+        layout_screen(&screen, &report, options);
+        diff_screen(&screen, options, &frame);
+        if (frame.length && write_all(STDOUT_FILENO, frame.data, frame.length) == -1) break;
+
+        // Wake on the next second for the clock, or early on a signal
+        struct timespec wall;
+        clock_gettime(CLOCK_REALTIME, &wall);
+        long long timeout = next_collect - monotonic_ms();
+        long long next_second = 1000 - wall.tv_nsec / 1000000;
+        if (timeout > next_second) timeout = next_second;
+        if (timeout > 0) poll(NULL, 0, (int)timeout);
+    }
+
+    const char leave[] = "\033[0m\033[?25h\033[?1049l";
+    write_all(STDOUT_FILENO, leave, sizeof(leave) - 1);
+
+    report_free(&report);
+    free(frame.data);
+    free(screen.front);
+    free(screen.back);
+    return EXIT_SUCCESS;
+}
+
+// Function to read exactly length bytes, -1 on end of file or error
+int read_exact(int fd, void* data, size_t length) {
+    char* p = data;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+// Function to send one frame: a 4-byte big-endian length followed by the payload
+int write_frame(int fd, const char* payload, size_t length) {
+    struct buffer frame = { 0 };
+    unsigned char header[4] = { length >> 24, length >> 16, length >> 8, length };
+    buffer_append(&frame, (const char*)header, sizeof(header));
+    buffer_append(&frame, payload, length);
+
+    int result = write_all(fd, frame.data, frame.length);
+    free(frame.data);
+    return result;
+}
+
+// A pure function to decode the payload length from a frame header
+size_t frame_length(const unsigned char* header) {
+    return (size_t)header[0] << 24 | (size_t)header[1] << 16 | (size_t)header[2] << 8 | header[3];
+}
+
+// Function to answer framed requests on stdin until it is closed
+int run_agent() {
+    unsigned char header[4];
+    char request[MAX_LINE_LENGTH];
+
+    while (read_exact(STDIN_FILENO, header, sizeof(header)) == 0) {
+        size_t length = frame_length(header);
+        if (length >= sizeof(request)) return EXIT_FAILURE;
+        if (read_exact(STDIN_FILENO, request, length) == -1) return EXIT_FAILURE;
+        request[length] = '\0';
+
+        struct buffer out = { 0 };
+        if (strcmp(request, "collect") == 0) {
+            struct report report;
+            collect_report(&report);
+            render_json(&report, &out);
+            report_free(&report);
+            out.length--; // The frame delimits the record, drop the newline
+        } else if (strcmp(request, "ping") == 0) {
+            buffer_append(&out, "\"pong\"", 6);
+        } else {
+            buffer_append(&out, "{\"error\":", 9);
+            buffer_append_json(&out, "unknown request");
+            buffer_append(&out, "}", 1);
+        }
+
+        int result = write_frame(STDOUT_FILENO, out.data, out.length);
+        free(out.data);
+        if (result == -1) return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// One host being collected by a transport process
+struct fanout_job {
+    char* host;
+    pid_t pid;
+    int fd;
+    long long deadline;
+    struct buffer response;
+};
+
+// Function to start the transport command for a host with the request already queued
+int start_fanout_job(struct fanout_job* job, const char* transport) {
+    int to_child[2], from_child[2];
+    if (pipe2(to_child, O_CLOEXEC) == -1) return -1;
+    if (pipe2(from_child, O_CLOEXEC) == -1) {
+        close(to_child[0]);
+        close(to_child[1]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, to_child[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, from_child[1], STDOUT_FILENO);
+
+    // A process group of its own lets a deadline kill the whole transport pipeline
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    // The host is passed as $1 so it is never parsed by the shell
+    char* argv[] = { "sh", "-c", (char*)transport, "sh", job->host, NULL };
+    extern char** environ;
+    int spawned = posix_spawn(&job->pid, "/bin/sh", &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(to_child[0]);
+    close(from_child[1]);
+
+    // The request fits in the pipe buffer, closing stdin lets the agent exit after answering
+    if (spawned == 0) write_frame(to_child[1], "collect", 7);
+    close(to_child[1]);
+
+    if (spawned != 0) {
+        close(from_child[0]);
+        return -1;
+    }
+
+    fcntl(from_child[0], F_SETFL, O_NONBLOCK);
+    job->fd = from_child[0];
+    job->response.length = 0;
+    return 0;
+}
+
+// Function to print the outcome of a host as one JSON line
+void print_fanout_result(const char* host, const char* report, size_t length, const char* error) {
+    struct buffer line = { 0 };
+    buffer_append(&line, "{\"host\":", 8);
+    buffer_append_json(&line, host);
+
+    if (error) {
+        buffer_append(&line, ",\"error\":", 9);
+        buffer_append_json(&line, error);
+    } else {
+        buffer_append(&line, ",\"report\":", 10);
+        buffer_append(&line, report, length);
+    }
+
+    buffer_append(&line, "}\n", 2);
+    write_all(STDOUT_FILENO, line.data, line.length);
+    free(line.data);
+}
+
+// Function to report a finished host and reap its transport process group
+void finish_fanout_job(struct fanout_job* job, const char* error) {
+    // Only look past the frame header once a full header has arrived
+    const char* payload = NULL;
+    size_t length = 0;
+    if (job->response.data && job->response.length > 4) {
+        payload = job->response.data + 4;
+        length = job->response.length - 4;
+    }
+    // The payload is copied into the output verbatim, a newline in it would forge records for other hosts
+    int valid = length > 1 && frame_length((unsigned char*)job->response.data) == length &&
+                payload[0] == '{' && payload[length - 1] == '}' && !memchr(payload, '\n', length) &&
+                !memchr(payload, '\r', length);
+
+    print_fanout_result(job->host, payload, length, error ? error : valid ? NULL : "invalid response");
+
+    close(job->fd);
+    kill(-job->pid, SIGKILL);
+    waitpid(job->pid, NULL, 0);
+    job->fd = -1;
+    free(job->host);
+    job->host = NULL;
+}
+
+// Function to read the next host name from a host file, skipping blanks and comments
+char* read_host(FILE* file, char* line, size_t size) {
+    while (fgets(line, size, file)) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        char* host = line + strspn(line, " \t");
+        host[strcspn(host, " \t")] = '\0';
+        if (*host) return host;
+    }
+    return NULL;
+}
+
+// Function to collect every host of a host file concurrently and stream the results
+int run_fanout(const char* host_file, int jobs, long timeout_ms) {
+    FILE* file = strcmp(host_file, "-") == 0 ? stdin : fopen(host_file, "r");
+    if (!file) handle_error("Error opening host file");
+
+    const char* transport = get_env_or_default("XFETCH_TRANSPORT", FANOUT_TRANSPORT_DEFAULT);
+    struct fanout_job* running = calloc(jobs, sizeof(*running));
+    struct pollfd* pfds = calloc(jobs, sizeof(*pfds));
+    if (!running || !pfds) handle_error("Memory allocation failed");
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int active = 0;
+    int more_hosts = 1;
+    char line[MAX_LINE_LENGTH];
+    while (more_hosts || active > 0) {
+        // Fill free slots from the host file, bounded by --jobs
+        for (int i = 0; i < jobs && more_hosts; i++) {
+            if (running[i].host) continue;
+
+            char* host = read_host(file, line, sizeof(line));
+            if (!host) {
+                more_hosts = 0;
+                break;
+            }
+
+            // A leading dash would reach the transport as an option, e.g. -oProxyCommand=...
+            if (host[0] == '-') {
+                print_fanout_result(host, NULL, 0, "invalid host name");
+                i--;
+                continue;
+            }
+
+            running[i].host = strdup(host);
+            if (!running[i].host) handle_error("Memory allocation failed");
+            running[i].deadline = monotonic_ms() + timeout_ms;
+            if (start_fanout_job(&running[i], transport) == -1) {
+                print_fanout_result(host, NULL, 0, "spawn failed");
+                free(running[i].host);
+                running[i].host = NULL;
+                continue;
+            }
+            active++;
+        }
+        if (active == 0) continue;
+
+        long long now = monotonic_ms();
+        long long wait = timeout_ms;
+        for (int i = 0; i < jobs; i++) {
+            pfds[i].fd = running[i].host ? running[i].fd : -1;
+            pfds[i].events = POLLIN;
+            if (running[i].host && running[i].deadline - now < wait) wait = running[i].deadline - now;
+        }
+        poll(pfds, jobs, wait > 0 ? (int)wait : 0);
+
+        now = monotonic_ms();
+        for (int i = 0; i < jobs; i++) {
+            struct fanout_job* job = &running[i];
+            if (!job->host) continue;
+
+            const char* error = NULL;
+            int done = 0;
+            if (pfds[i].revents) {
+                char chunk[4096];
+                ssize_t n = read(job->fd, chunk, sizeof(chunk));
+                if (n > 0) {
+                    buffer_append(&job->response, chunk, n);
+                } else if (n == 0) {
+                    done = 1;
+                    if (job->response.length < 4) error = "no response";
+                } else if (errno != EAGAIN && errno != EINTR) {
+                    done = 1;
+                    error = strerror(errno);
+                }
+
+                // Stream the host as soon as its frame is complete, without waiting for exit
+                if (job->response.length >= 4) {
+                    size_t expected = frame_length((unsigned char*)job->response.data);
+                    if (expected > MAX_FRAME_LENGTH) {
+                        done = 1;
+                        error = "oversized response";
+                    } else if (job->response.length >= expected + 4) {
+                        job->response.length = expected + 4;
+                        done = 1;
+                    }
+                }
+            }
+            if (!done && now >= job->deadline) {
+                done = 1;
+                error = "timeout";
+            }
+            if (!done) continue;
+
+            finish_fanout_job(job, error);
+            active--;
+        }
+    }
+
+    for (int i = 0; i < jobs; i++) free(running[i].response.data);
+    free(running);
+    free(pfds);
+    if (file != stdin) fclose(file);
+    return EXIT_SUCCESS;
+}
+
+// Function to build the path of the daemon socket, creating its private directory when asked to
+int get_daemon_socket_path(char* path, size_t size, int create) {
+    const char* override = getenv("XFETCH_SOCKET");
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+    int length;
+
+    if (override && *override) {
+        length = snprintf(path, size, "%s", override);
+    } else if (runtime_dir && *runtime_dir) {
+        length = snprintf(path, size, "%s/xfetch.sock", runtime_dir);
+    } else {
+        // /tmp is shared, so the socket only lives in a directory that this user owns and nobody else can enter
+        char dir[64];
+        snprintf(dir, sizeof(dir), "/tmp/xfetch-%d", (int)getuid());
+        if (create && mkdir(dir, 0700) == -1 && errno != EEXIST) return -1;
+
+        struct stat st;
+        if (lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 0077)) {
+            return -1;
+        }
+        length = snprintf(path, size, "%s/xfetch.sock", dir);
+    }
+    return length < 0 || (size_t)length >= size ? -1 : 0;
+}
+
+// A pure function to check that the process on the other end of a unix socket runs as this user
+int peer_is_self(int fd) {
+    struct ucred cred;
+    socklen_t length = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0 && cred.uid == getuid();
+}
+
+// Function to hash the environment the collectors read, the tty is sent along separately
+uint64_t hash_session() {
+    static const char* const vars[] = {
+        "XDG_SESSION_TYPE", "XDG_CURRENT_DESKTOP", "DESKTOP_SESSION", "DISPLAY", "WAYLAND_DISPLAY",
+        "XDG_RUNTIME_DIR", "LC_ALL", "LANG", "TZ", "PATH", "HOME", "RUSTUP_HOME", "RUSTUP_TOOLCHAIN",
+        "JACK_TMPDIR", "DBUS_SYSTEM_BUS_ADDRESS",
+    };
+    uint64_t key = HASH_SEED;
+    for (size_t i = 0; i < sizeof(vars) / sizeof(vars[0]); i++) {
+        const char* value = getenv(vars[i]);
+        key = value ? hash_bytes(key, value, strlen(value) + 1) : hash_bytes(key, "-", 1);
+    }
+    return key;
+}
+
+// A client connection of the daemon
+struct daemon_client {
+    int fd;
+    struct buffer in;
+    struct buffer out;
+    size_t sent;
+    int waiting;
+    uint64_t wait_version;
+    uint64_t wait_mask;
+    int blob_fd;
+    size_t blob_at;
+    int http;
+    int close_after;
+    int closed;
+    struct daemon_client* next;
+};
+
+// A report rendered once per change into a sealed memfd that clients receive instead of bytes
+struct blob {
+    struct render_options options;
+    char* last_login;
+    int fd;
+    uint64_t used;
+};
+
+// Daemon state: the latest report and the version at which each field last changed
+struct daemon_state {
+    struct report report;
+    uint64_t version;
+    uint64_t field_versions[MAX_FIELDS];
+    int epoll_fd;
+    struct daemon_client* clients;
+    struct blob blobs[MAX_BLOBS];
+    size_t blob_count;
+    uint64_t blob_clock;
+    uint64_t session;
+    long long collected_at;
+    long long max_age_ms;
+    struct buffer metrics_body;
+    struct buffer json_body;
+};
+
+// Function to collect a fresh report, bumping the version of every field that changed
+uint64_t daemon_collect(struct daemon_state* state) {
+    struct report report;
+    collect_report(&report);
+
+    uint64_t changed = 0;
+    for (size_t i = 0; i < report.count; i++) {
+        const char* previous = i < state->report.count ? state->report.fields[i].value : NULL;
+        if (i < state->report.count && values_equal(previous, report.fields[i].value)) continue;
+        changed |= 1ULL << i;
+    }
+
+    // One collection is one version, however many fields it changed
+    if (changed) {
+        state->version++;
+        for (size_t i = 0; i < report.count; i++) {
+            if (changed & (1ULL << i)) state->field_versions[i] = state->version;
+        }
+    }
+
+    // Clients already holding a blob keep their own reference to it
+    if (changed) {
+        for (size_t i = 0; i < state->blob_count; i++) {
+            close(state->blobs[i].fd);
+            free(state->blobs[i].last_login);
+        }
+        state->blob_count = 0;
+        state->metrics_body.length = state->json_body.length = 0;
+    }
+
+    report_free(&state->report);
+    state->report = report;
+    state->collected_at = monotonic_ms();
+    return changed;
+}
+
+// Function to render the selected fields with their versions as one JSON line
+void render_versioned(const struct daemon_state* state, uint64_t mask, struct buffer* out) {
+    buffer_printf(out, "{\"version\":%llu,\"fields\":{", (unsigned long long)state->version);
+    int first = 1;
+    for (size_t i = 0; i < state->report.count; i++) {
+        if (!(mask & (1ULL << i))) continue;
+        const struct field* field = &state->report.fields[i];
+        buffer_printf(out, "%s\"%s\":{\"version\":%llu,\"value\":", first ? "" : ",", field->key,
+                      (unsigned long long)state->field_versions[i]);
+        buffer_append_json(out, field->value);
+        buffer_append(out, "}", 1);
+        first = 0;
+    }
+    buffer_append(out, "}}\n", 3);
+}
+
+// Function to turn a comma-separated list of field keys into a mask, an empty list selects all
+uint64_t parse_field_mask(const struct daemon_state* state, const char* list) {
+    if (!list || !*list) return ~0ULL;
+
+    uint64_t mask = 0;
+    while (*list) {
+        size_t length = strcspn(list, ",");
+        for (size_t i = 0; i < state->report.count; i++) {
+            const char* key = state->report.fields[i].key;
+            if (strlen(key) == length && strncmp(key, list, length) == 0) mask |= 1ULL << i;
+        }
+        list += length + (list[length] == ',');
+    }
+    return mask;
+}
+
+// A pure function to check whether a waiting client has something newer than it saw
+int client_has_news(const struct daemon_state* state, const struct daemon_client* client) {
+    for (size_t i = 0; i < state->report.count; i++) {
+        if ((client->wait_mask & (1ULL << i)) && state->field_versions[i] > client->wait_version) return 1;
+    }
+    return 0;
+}
+
+// A pure function to check whether two sets of render options produce the same bytes
+int render_options_equal(const struct render_options* a, const struct render_options* b) {
+    return a->format == b->format && a->width == b->width && a->colors == b->colors && a->logo == b->logo;
+}
+
+// Function to get the blob for a set of render options and a client tty, rendering it on first request after a change
+int get_blob(struct daemon_state* state, const struct render_options* options, const char* tty) {
+    // The previous login depends on the client's terminal, so it is looked up for that tty and keys the blob
+    char* last_login = get_last_login_on(tty);
+    for (size_t i = 0; i < state->blob_count; i++) {
+        if (render_options_equal(&state->blobs[i].options, options) &&
+            values_equal(state->blobs[i].last_login, last_login)) {
+            free(last_login);
+            state->blobs[i].used = ++state->blob_clock;
+            return state->blobs[i].fd;
+        }
+    }
+
+    // One-shot runs show no GPU Load line, so neither do the reports they receive from the daemon
+    struct report report = state->report;
+    for (size_t i = 0; i < report.count; i++) {
+        if (strcmp(report.fields[i].key, "gpu_load") == 0) report.fields[i].value = NULL;
+        if (strcmp(report.fields[i].key, "last_login") == 0) report.fields[i].value = last_login;
+    }
+
+    struct buffer out = { 0 };
+    render_report(&report, options, &out);
+
+    int fd = memfd_create("xfetch-report", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd != -1 && (write_all(fd, out.data, out.length) == -1 ||
+                     fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)) {
+        close(fd);
+        fd = -1;
+    }
+    free(out.data);
+    if (fd == -1) {
+        free(last_login);
+        return -1;
+    }
+
+    // Terminals of many widths take turns, so the least recently used blob makes room
+    struct blob* blob = &state->blobs[state->blob_count];
+    if (state->blob_count == MAX_BLOBS) {
+        blob = &state->blobs[0];
+        for (size_t i = 1; i < MAX_BLOBS; i++) {
+            if (state->blobs[i].used < blob->used) blob = &state->blobs[i];
+        }
+        close(blob->fd);
+        free(blob->last_login);
+    } else {
+        state->blob_count++;
+    }
+    memset(blob, 0, sizeof(*blob));
+    blob->options = *options;
+    blob->last_login = last_login;
+    blob->fd = fd;
+    blob->used = ++state->blob_clock;
+    return fd;
+}
+
+// Function to send one byte of queued output with a file descriptor attached
+ssize_t send_with_fd(int socket_fd, const char* data, int fd) {
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = (void*)data, .iov_len = 1 };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                          .msg_controllen = sizeof(control.buf) };
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+}
+
+// Function to send as much queued output as the socket takes, watching for writability otherwise
+int client_flush(struct daemon_state* state, struct daemon_client* client) {
+    while (client->sent < client->out.length) {
+        // The byte at blob_at carries the descriptor, everything before it goes out plainly
+        ssize_t n;
+        if (client->blob_fd != -1 && client->sent == client->blob_at) {
+            n = send_with_fd(client->fd, client->out.data + client->sent, client->blob_fd);
+            if (n > 0) {
+                close(client->blob_fd);
+                client->blob_fd = -1;
+            }
+        } else {
+            size_t length = client->out.length - client->sent;
+            if (client->blob_fd != -1) length = client->blob_at - client->sent;
+            n = send(client->fd, client->out.data + client->sent, length, MSG_NOSIGNAL);
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) break;
+        if (n <= 0) return -1;
+        client->sent += n;
+    }
+
+    if (client->sent == client->out.length) {
+        client->sent = client->out.length = 0;
+        if (client->close_after) return -1;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN | (client->out.length ? EPOLLOUT : 0), .data.ptr = client };
+    epoll_ctl(state->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+    return 0;
+}
+
+// Function to answer a parked client with the fields it waits on
+void answer_waiting_client(struct daemon_state* state, struct daemon_client* client) {
+    render_versioned(state, client->wait_mask, &client->out);
+    client->waiting = 0;
+}
+
+// Function to handle one request line of a client
+void handle_daemon_request(struct daemon_state* state, struct daemon_client* client, char* line) {
+    char* save = NULL;
+    char* command = strtok_r(line, " ", &save);
+    if (!command) return;
+    PROBE2(daemon__request, command, client->fd);
+
+    if (strcmp(command, "GET") == 0) {
+        render_versioned(state, parse_field_mask(state, strtok_r(NULL, " ", &save)), &client->out);
+    } else if (strcmp(command, "BLOB") == 0) {
+        // BLOB <format> <width> <colors> <logo> <session> <tty>: answered with "+" and a memfd, or "-"
+        const char* format = strtok_r(NULL, " ", &save);
+        const char* width = strtok_r(NULL, " ", &save);
+        const char* colors = strtok_r(NULL, " ", &save);
+        const char* logo_flag = strtok_r(NULL, " ", &save);
+        const char* session = strtok_r(NULL, " ", &save);
+        const char* tty = strtok_r(NULL, " ", &save);
+        struct render_options options = { .format = FORMAT_TEXT };
+        int fd = -1;
+
+        // Another environment sees other values, and a report that missed its collection tick has gone stale
+        int usable = tty && strtoull(session, NULL, 16) == state->session &&
+                     monotonic_ms() - state->collected_at <= state->max_age_ms;
+        if (usable && client->blob_fd == -1) {
+            options.format = (enum output_format)atoi(format);
+            options.width = strtoul(width, NULL, 10);
+            options.colors = (enum color_depth)atoi(colors);
+            options.logo = atoi(logo_flag) != 0;
+
+            // Only the text layout depends on the width
+            if (options.format != FORMAT_TEXT) options.width = 0;
+            if (strcmp(tty, "-") == 0) tty = NULL;
+            if (options.format <= FORMAT_SH && options.colors <= COLOR_TRUE) fd = get_blob(state, &options, tty);
+        }
+
+        if (fd != -1 && (client->blob_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) != -1) {
+            client->blob_at = client->out.length;
+            buffer_append(&client->out, "+", 1);
+        } else {
+            buffer_append(&client->out, "-", 1);
+        }
+    } else if (strcmp(command, "WAIT") == 0) {
+        // WAIT <version> [keys]: block until one of the keys changes beyond version
+        const char* version = strtok_r(NULL, " ", &save);
+        client->wait_version = version ? strtoull(version, NULL, 10) : 0;
+        client->wait_mask = parse_field_mask(state, strtok_r(NULL, " ", &save));
+        client->waiting = 1;
+        if (client_has_news(state, client)) answer_waiting_client(state, client);
+    } else {
+        buffer_append(&client->out, "{\"error\":\"unknown request\"}\n", 29);
+    }
+}
+
+// Function to append a string as an OpenMetrics label value
+void buffer_append_label(struct buffer* buffer, const char* str) {
+    buffer_append(buffer, "\"", 1);
+    for (; *str; str++) {
+        if (*str == '\\' || *str == '"') {
+            buffer_append(buffer, "\\", 1);
+            buffer_append(buffer, str, 1);
+        } else if (*str == '\n') {
+            buffer_append(buffer, "\\n", 2);
+        } else {
+            buffer_append(buffer, str, 1);
+        }
+    }
+    buffer_append(buffer, "\"", 1);
+}
+
+// Function to render the report as OpenMetrics: an info metric labelled with the identity of the system
+void render_metrics(const struct daemon_state* state, struct buffer* out) {
+    // Every distinct label set is a new series, so values that change over time stay out of the labels
+    static const char* const info_keys[] = { "os", "kernel", "cpu", "gpu", "host" };
+
+    buffer_printf(out, "# TYPE xfetch info\n# HELP xfetch Description of this system.\nxfetch_info{");
+    int first = 1;
+    for (size_t i = 0; i < state->report.count; i++) {
+        const struct field* field = &state->report.fields[i];
+        int info = 0;
+        for (size_t k = 0; k < sizeof(info_keys) / sizeof(info_keys[0]); k++) {
+            if (strcmp(field->key, info_keys[k]) == 0) info = 1;
+        }
+        if (!info || !field->value) continue;
+        buffer_printf(out, "%s%s=", first ? "" : ",", field->key);
+        buffer_append_label(out, field->value);
+        first = 0;
+    }
+    buffer_printf(out, "} 1\n");
+
+    buffer_printf(out, "# TYPE xfetch_report_version gauge\n# HELP xfetch_report_version Collections that changed a field.\n");
+    buffer_printf(out, "xfetch_report_version %llu\n", (unsigned long long)state->version);
+    buffer_printf(out, "# TYPE xfetch_field_version gauge\n# HELP xfetch_field_version Report version that last changed the field.\n");
+    for (size_t i = 0; i < state->report.count; i++) {
+        buffer_printf(out, "xfetch_field_version{field=\"%s\"} %llu\n", state->report.fields[i].key,
+                      (unsigned long long)state->field_versions[i]);
+    }
+    buffer_append(out, "# EOF\n", 6);
+}
+
+// Function to answer one HTTP request, the bodies are rendered once per change and shared by every scrape
+void handle_http_request(struct daemon_state* state, struct daemon_client* client, char* head) {
+    char* save = NULL;
+    char* method = strtok_r(head, " ", &save);
+    char* target = strtok_r(NULL, " ", &save);
+    char* version = strtok_r(NULL, "\r\n", &save);
+    PROBE2(http__request, method, target);
+
+    // HTTP/1.1 keeps the connection unless told otherwise, HTTP/1.0 only when asked to
+    int keep_alive = version && strcmp(version, "HTTP/1.1") == 0;
+    for (char* header; (header = strtok_r(NULL, "\r\n", &save));) {
+        if (strncasecmp(header, "Connection:", 11) != 0) continue;
+        if (strcasestr(header + 11, "close")) keep_alive = 0;
+        if (strcasestr(header + 11, "keep-alive")) keep_alive = 1;
+    }
+
+    const char* status = "200 OK";
+    const char* content_type = "text/plain; charset=utf-8";
+    const struct buffer* body = NULL;
+    if (!method || !target || !version || strncmp(version, "HTTP/1.", 7) != 0) {
+        status = "400 Bad Request";
+        keep_alive = 0;
+    } else if (strcmp(method, "GET") != 0 && strcmp(method, "HEAD") != 0) {
+        status = "405 Method Not Allowed";
+    } else if (strcmp(target, "/metrics") == 0) {
+        if (!state->metrics_body.length) render_metrics(state, &state->metrics_body);
+        content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+        body = &state->metrics_body;
+    } else if (strcmp(target, "/json") == 0) {
+        if (!state->json_body.length) render_json(&state->report, &state->json_body);
+        content_type = "application/json";
+        body = &state->json_body;
+    } else {
+        status = "404 Not Found";
+    }
+
+    buffer_printf(&client->out, "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+                  status, content_type, body ? body->length : 0, keep_alive ? "keep-alive" : "close");
+    if (body && strcmp(method, "HEAD") != 0) buffer_append(&client->out, body->data, body->length);
+    if (!keep_alive) client->close_after = 1;
+}
+
+// Function to drop a client connection, its memory is released by reap_daemon_clients
+void close_daemon_client(struct daemon_state* state, struct daemon_client* client) {
+    // Later events of the same epoll batch may still point at the client, so it stays allocated until then
+    if (client->closed) return;
+    client->closed = 1;
+    client->waiting = 0;
+    epoll_ctl(state->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    if (client->blob_fd != -1) close(client->blob_fd);
+    client->blob_fd = -1;
+}
+
+// Function to free every client closed during the last batch of events
+void reap_daemon_clients(struct daemon_state* state) {
+    for (struct daemon_client** link = &state->clients; *link;) {
+        struct daemon_client* client = *link;
+        if (!client->closed) {
+            link = &client->next;
+            continue;
+        }
+        *link = client->next;
+        free(client->in.data);
+        free(client->out.data);
+        free(client);
+    }
+}
+
+// Function to process the complete request lines of a client in order, pausing at a parked WAIT
+void process_daemon_requests(struct daemon_state* state, struct daemon_client* client) {
+    // HTTP requests end at the blank line after the headers, request bodies are not accepted
+    char* end;
+    while (client->http && !client->close_after && (end = memmem(client->in.data, client->in.length, "\r\n\r\n", 4))) {
+        *end = '\0';
+        handle_http_request(state, client, client->in.data);
+
+        size_t consumed = end + 4 - client->in.data;
+        memmove(client->in.data, end + 4, client->in.length - consumed);
+        client->in.length -= consumed;
+    }
+
+    // Replies go out in request order, so nothing behind a WAIT is answered before it
+    char* newline;
+    while (!client->http && !client->waiting && client->in.length &&
+           (newline = memchr(client->in.data, '\n', client->in.length))) {
+        *newline = '\0';
+        if (newline > client->in.data && newline[-1] == '\r') newline[-1] = '\0';
+        handle_daemon_request(state, client, client->in.data);
+
+        size_t consumed = newline + 1 - client->in.data;
+        memmove(client->in.data, newline + 1, client->in.length - consumed);
+        client->in.length -= consumed;
+    }
+}
+
+// Function to read from a client and process the request lines it completed
+int read_daemon_client(struct daemon_state* state, struct daemon_client* client) {
+    char chunk[1024];
+    ssize_t n;
+    while ((n = recv(client->fd, chunk, sizeof(chunk), 0)) > 0) buffer_append(&client->in, chunk, n);
+    if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR)) return -1;
+
+    process_daemon_requests(state, client);
+    return client->in.length > MAX_REQUEST_LENGTH ? -1 : 0;
+}
+
+// Function to create the listening unix socket, replacing a stale one
+int listen_unix_socket(const char* path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+
+    // A socket that still accepts connections belongs to a running daemon
+    if (get_socket_peer_pid(path) > 0) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    mode_t mask = umask(0077);
+    int bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+    if (bound == -1 || listen(fd, SOMAXCONN) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function to listen on the HTTP address: a unix socket path, a port on localhost, or HOST:PORT
+int listen_http(const char* address) {
+    if (address[0] == '/') return listen_unix_socket(address);
+
+    char host[256] = "127.0.0.1";
+    const char* port = address;
+    const char* colon = strrchr(address, ':');
+    if (address[0] == '[') {
+        // [ADDRESS]:PORT, the brackets keep the colons of an IPv6 address apart from the port
+        const char* close = strchr(address, ']');
+        if (!close || close[1] != ':' || (size_t)(close - address - 1) >= sizeof(host)) return -1;
+        memcpy(host, address + 1, close - address - 1);
+        host[close - address - 1] = '\0';
+        port = close + 2;
+    } else if (colon) {
+        size_t length = colon - address;
+        if (length >= sizeof(host)) return -1;
+        memcpy(host, address, length);
+        host[length] = '\0';
+        port = colon + 1;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICSERV };
+    struct addrinfo* result;
+    if (getaddrinfo(host, port, &hints, &result) != 0) return -1;
+
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == -1 || listen(fd, SOMAXCONN) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+// Function to accept every pending connection on a listening socket
+void accept_daemon_clients(struct daemon_state* state, int listen_fd, int http) {
+    int fd;
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        // The report socket serves only its owner, whatever the permissions on its path
+        if (!http && !peer_is_self(fd)) {
+            close(fd);
+            continue;
+        }
+
+        struct daemon_client* client = calloc(1, sizeof(*client));
+        if (!client) handle_error("Memory allocation failed");
+        client->fd = fd;
+        client->blob_fd = -1;
+        client->http = http;
+        client->next = state->clients;
+        state->clients = client;
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = client };
+        epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+// Function to run the daemon: collect every interval and serve clients from an epoll loop
+int run_daemon(long interval_ms, const char* http_address) {
+    char path[PATH_MAX];
+    if (get_daemon_socket_path(path, sizeof(path), 1) == -1) handle_error("Invalid daemon socket path");
+
+    int listen_fd = listen_unix_socket(path);
+    if (listen_fd == -1) handle_error("Error listening on daemon socket");
+    enable_gpu_monitors();
+
+    int http_fd = -1;
+    if (http_address && (http_fd = listen_http(http_address)) == -1) handle_error("Error listening for HTTP");
+
+    signal(SIGPIPE, SIG_IGN);
+
+    struct daemon_state state = { .version = 0, .clients = NULL };
+    state.report.count = 0;
+    state.session = hash_session();
+    state.max_age_ms = interval_ms + DAEMON_AGE_SLACK_MS;
+    state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (state.epoll_fd == -1 || timer_fd == -1) handle_error("Error setting up the event loop");
+
+    struct itimerspec interval = {
+        .it_interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000L },
+        .it_value = { interval_ms / 1000, (interval_ms % 1000) * 1000000L },
+    };
+    timerfd_settime(timer_fd, 0, &interval, NULL);
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &listen_fd };
+    epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.ptr = &timer_fd;
+    epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+    if (http_fd != -1) {
+        event.data.ptr = &http_fd;
+        epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, http_fd, &event);
+    }
+
+    daemon_collect(&state);
+
+    for (;;) {
+        struct epoll_event events[64];
+        int count = epoll_wait(state.epoll_fd, events, 64, -1);
+        if (count == -1 && errno != EINTR) handle_error("Error waiting for events");
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == &listen_fd) {
+                accept_daemon_clients(&state, listen_fd, 0);
+            } else if (events[i].data.ptr == &http_fd) {
+                accept_daemon_clients(&state, http_fd, 1);
+            } else if (events[i].data.ptr == &timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == -1) continue;
+
+                // Every parked client is answered from this one collection
+                if (!daemon_collect(&state)) continue;
+                for (struct daemon_client* client = state.clients, *next; client; client = next) {
+                    next = client->next;
+                    if (!client->waiting || !client_has_news(&state, client)) continue;
+                    answer_waiting_client(&state, client);
+                    process_daemon_requests(&state, client);
+                    if (client_flush(&state, client) == -1) close_daemon_client(&state, client);
+                }
+            } else {
+                struct daemon_client* client = events[i].data.ptr;
+                if (client->closed) continue;
+                int failed = (events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & EPOLLIN);
+                if (!failed && (events[i].events & EPOLLIN)) failed = read_daemon_client(&state, client) == -1;
+                if (!failed) failed = client_flush(&state, client) == -1;
+                if (failed) close_daemon_client(&state, client);
+            }
+        }
+        reap_daemon_clients(&state);
+    }
+}
+
+// Function to connect to the daemon socket
+int connect_daemon() {
+    char path[PATH_MAX];
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (get_daemon_socket_path(path, sizeof(path), 0) == -1 || strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+
+    // Whoever answers must be this user, the socket path alone proves nothing
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || !peer_is_self(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function to ask the daemon for the report rendered with the given options, returning its memfd
+int fetch_daemon_blob(const struct render_options* options) {
+    int fd = connect_daemon();
+    if (fd == -1) return -1;
+
+    const char* tty = ttyname(STDIN_FILENO);
+    if (tty && strncmp(tty, "/dev/", 5) == 0) tty += 5;
+    if (!tty || !*tty || strlen(tty) > 64 || strchr(tty, ' ')) tty = "-";
+
+    char request[256];
+    int length = snprintf(request, sizeof(request), "BLOB %d %zu %d %d %llx %s\n", (int)options->format,
+                          options->width, (int)options->colors, options->logo, (unsigned long long)hash_session(), tty);
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    char reply = 0;
+    struct iovec iov = { .iov_base = &reply, .iov_len = 1 };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                          .msg_controllen = sizeof(control.buf) };
+
+    // A stuck daemon must not cost more than falling back to collecting directly
+    int blob_fd = -1;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (write_all(fd, request, length) == 0 && poll(&pfd, 1, DAEMON_TIMEOUT_MS) == 1 &&
+        recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) == 1 && reply == '+') {
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&blob_fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    close(fd);
+
+    // Only a sealed memfd is known to hold a finished report that nobody can change underneath
+    struct stat st;
+    int required = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+    int seals = blob_fd != -1 ? fcntl(blob_fd, F_GET_SEALS) : -1;
+    if (blob_fd != -1 && (seals == -1 || (seals & required) != required || fstat(blob_fd, &st) == -1 ||
+                          !S_ISREG(st.st_mode))) {
+        close(blob_fd);
+        blob_fd = -1;
+    }
+    return blob_fd;
+}
+
+// Function to copy a blob to stdout inside the kernel, falling back to a mapping where sendfile refuses
+int write_blob(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) return -1;
+
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        ssize_t n = sendfile(STDOUT_FILENO, fd, &offset, st.st_size - offset);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) {
+            struct pollfd pfd = { .fd = STDOUT_FILENO, .events = POLLOUT };
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (n <= 0) break;
+    }
+    if (offset == st.st_size) return 0;
+
+    // Only a copy that has not started yet can be redone with plain writes
+    if (offset != 0) return -1;
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return -1;
+    int status = write_all(STDOUT_FILENO, data, st.st_size);
+    munmap(data, st.st_size);
+    return status;
+}
+
+// Function to print a JSON line every time one of the fields changes, blocking in the daemon in between
+int run_subscribe(const char* fields) {
+    int fd = connect_daemon();
+    if (fd == -1) handle_error("Error connecting to the xfetch daemon");
+
+    FILE* replies = fdopen(fd, "r");
+    if (!replies) handle_error("Error reading from the xfetch daemon");
+
+    unsigned long long version = 0;
+    char* line = NULL;
+    size_t capacity = 0;
+    for (;;) {
+        char request[MAX_REQUEST_LENGTH];
+        int length = snprintf(request, sizeof(request), "WAIT %llu %s\n", version, fields);
+        if (length >= (int)sizeof(request) || write_all(fd, request, length) == -1) break;
+
+        ssize_t n = getline(&line, &capacity, replies);
+        if (n <= 0) break;
+        if (write_all(STDOUT_FILENO, line, n) == -1) break;
+        if (sscanf(line, "{\"version\":%llu", &version) != 1) break;
+    }
+
+    free(line);
+    fclose(replies);
+    return EXIT_FAILURE;
+}
+
+// Function to print usage information
+void print_usage(FILE* stream) {
+    fprintf(stream,
+            "Usage: xfetch [options]\n"
+            "  --format FORMAT    output format: text, json, ndjson or sh (default text)\n"
+            "  --no-logo          print the text report without the logo column (only shown on a terminal)\n"
+            "  --watch            keep running and re-collect every interval\n"
+            "  --live             full-screen dashboard that redraws only what changes\n"
+            "  --interval SECS    seconds between collections in watch or live mode (default 2)\n"
+            "  --publish-system   write the system-wide fields to " SNAPSHOT_PATH " (run as root)\n"
+            "  --daemon           serve versioned reports on $XDG_RUNTIME_DIR/xfetch.sock; one-shot runs\n"
+            "                     from the same environment reuse its latest report\n"
+            "  --listen ADDRESS   with --daemon, serve /metrics and /json over HTTP on a localhost PORT,\n"
+            "                     HOST:PORT, [IPV6]:PORT or unix socket path\n"
+            "  --subscribe KEYS   print the comma-separated fields from the daemon whenever they change\n"
+            "  --agent            answer framed requests on stdin/stdout\n"
+            "  --fanout HOSTFILE  collect every host through $XFETCH_TRANSPORT, one JSON line each\n"
+            "  --jobs N           hosts collected concurrently by --fanout (default 64)\n"
+            "  --timeout SECS     per-host deadline for --fanout (default 10)\n"
+            "  --help             show this help\n");
+}
+
+// Main function
+int main(int argc, char** argv) {
+    enum output_format format = FORMAT_TEXT;
+    int show_logo = 1;
+    int watch = 0;
+    int live = 0;
+    long interval_ms = WATCH_INTERVAL_MS_DEFAULT;
+    int agent = 0;
+    int publish_system = 0;
+    int daemon_mode = 0;
+    const char* subscribe = NULL;
+    const char* http_address = NULL;
+    const char* host_file = NULL;
+    int jobs = FANOUT_JOBS_DEFAULT;
+    long timeout_ms = FANOUT_TIMEOUT_MS_DEFAULT;
+
+    static const struct option long_options[] = {
+        { "format", required_argument, NULL, 'f' },
+        { "no-logo", no_argument, NULL, 'L' },
+        { "watch", no_argument, NULL, 'w' },
+        { "live", no_argument, NULL, 'l' },
+        { "interval", required_argument, NULL, 'i' },
+        { "agent", no_argument, NULL, 'a' },
+        { "publish-system", no_argument, NULL, 'P' },
+        { "daemon", no_argument, NULL, 'D' },
+        { "subscribe", required_argument, NULL, 's' },
+        { "listen", required_argument, NULL, 'H' },
+        { "fanout", required_argument, NULL, 'F' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "timeout", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:Lwli:aPDs:H:F:j:t:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            if (strcmp(optarg, "text") == 0) {
+                format = FORMAT_TEXT;
+            } else if (strcmp(optarg, "json") == 0) {
+                format = FORMAT_JSON;
+            } else if (strcmp(optarg, "ndjson") == 0) {
+                format = FORMAT_NDJSON;
+            } else if (strcmp(optarg, "sh") == 0) {
+                format = FORMAT_SH;
+            } else {
+                fprintf(stderr, "xfetch: unknown format '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'L':
+            show_logo = 0;
+            break;
+        case 'w':
+            watch = 1;
+            break;
+        case 'l':
+            live = 1;
+            break;
+        case 'i':
+            interval_ms = (long)(strtod(optarg, NULL) * 1000);
+            if (interval_ms <= 0) {
+                fprintf(stderr, "xfetch: invalid interval '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'a':
+            agent = 1;
+            break;
+        case 'P':
+            publish_system = 1;
+            break;
+        case 'D':
+            daemon_mode = 1;
+            break;
+        case 's':
+            subscribe = optarg;
+            break;
+        case 'H':
+            http_address = optarg;
+            break;
+        case 'F':
+            host_file = optarg;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            if (jobs <= 0) {
+                fprintf(stderr, "xfetch: invalid job count '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            timeout_ms = (long)(strtod(optarg, NULL) * 1000);
+            if (timeout_ms <= 0) {
+                fprintf(stderr, "xfetch: invalid timeout '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h':
+            print_usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            print_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (publish_system) return run_publish_system();
+    if (daemon_mode) return run_daemon(interval_ms, http_address);
+    if (subscribe) return run_subscribe(subscribe);
+    if (agent) return run_agent();
+    if (host_file) return run_fanout(host_file, jobs, timeout_ms);
+    struct render_options options = {
+        .format = format,
+        .width = get_terminal_width(),
+        .colors = format == FORMAT_TEXT ? detect_color_depth() : COLOR_NONE,
+        .logo = format == FORMAT_TEXT && show_logo && isatty(STDOUT_FILENO),
+    };
+
+    if (live) return run_live(&options, interval_ms);
+    if (watch) return run_watch(&options, interval_ms);
+
+    // A running daemon has the report rendered already, stdout only needs the bytes
+    int blob_fd = fetch_daemon_blob(&options);
+    if (blob_fd != -1) {
+        int status = write_blob(blob_fd) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        close(blob_fd);
+        return status;
+    }
+
+    struct report report;
+    struct buffer out = { 0 };
+    collect_report(&report);
+    render_report(&report, &options, &out);
+
+    int status = write_all(STDOUT_FILENO, out.data, out.length) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Free allocated memory
+    report_free(&report);
+    free(out.data);
+
+    return status;
+}